@@ -0,0 +1,170 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "algo.h"
+#include <iostream>
+
+using namespace std;
+
+AdaptiveJoiner::AdaptiveJoiner(const libconfig::Setting& cfg)
+    : BaseAlgo(cfg), chosen_(NULL), cache_(NULL), hit_rate_(1.0)
+{
+    copy_ = new ProbePhase< BuildPhase< StoreCopy > >(cfg);
+    pointer_ = new ProbePhase< BuildPhase< StorePointer > >(cfg);
+}
+
+AdaptiveJoiner::~AdaptiveJoiner()
+{
+    delete copy_;
+    delete pointer_;
+}
+
+void AdaptiveJoiner::init(Schema *schema1, vector<unsigned int> select1, unsigned int jattr1,
+  Schema *schema2, vector<unsigned int> select2, unsigned int jattr2, unsigned int selectivity,
+  unsigned long long cond_s, unsigned long long cond_e)
+{
+    copy_->init(schema1, select1, jattr1, schema2, select2, jattr2, selectivity, cond_s, cond_e);
+    pointer_->init(schema1, select1, jattr1, schema2, select2, jattr2, selectivity, cond_s, cond_e);
+    chosen_ = choose();
+}
+
+void AdaptiveJoiner::destroy()
+{
+    copy_->destroy();
+    pointer_->destroy();
+}
+
+BaseAlgo* AdaptiveJoiner::choose()
+{
+    unsigned int copysize = copy_->get_build_tuple_size();
+    unsigned int rowsize = pointer_->get_build_tuple_size();
+    if (copysize <= rowsize)
+    {
+        return copy_;
+    }
+    if (cache_ && cache_->get_max_bytes() > 0
+            && cache_->get_used_bytes() > cache_->get_max_bytes() / BUDGET_SHARE_ * (BUDGET_SHARE_ - 1))
+    {
+        return pointer_;
+    }
+    return hit_rate_ * DEREF_BYTES_ >= copysize - rowsize ? copy_ : pointer_;
+}
+
+void AdaptiveJoiner::build(PageCursor* t, ht_node* node)
+{
+    store_of(node)->build(t, node);
+}
+
+PageCursor* AdaptiveJoiner::probe(PageCursor* t, ht_node* node)
+{
+    BaseAlgo* store = store_of(node);
+    PageCursor* out = store->probe(t, node);
+
+    // counted by the probe loop, whatever the output mode
+    unsigned long long matches, probed;
+    store->get_matches(matches, probed);
+    matches_ += matches;
+    probed_ += probed;
+    if (probed > 0)
+    {
+        hit_rate_ = (hit_rate_ + (double)matches / probed) / 2;
+    }
+    return out;
+}
+
+unsigned int AdaptiveJoiner::get_build_tuple_size()
+{
+    return chosen_->get_build_tuple_size();
+}
+
+unsigned int AdaptiveJoiner::get_build_key_size()
+{
+    return chosen_->get_build_key_size();
+}
+
+cache_key AdaptiveJoiner::get_cache_key(const string& table)
+{
+    cache_key key = copy_->get_cache_key(table);
+    key.store_ = cache_key::STORE_COPY | cache_key::STORE_ROWIDS;
+    return key;
+}
+
+cache_key AdaptiveJoiner::get_build_key(const string& table)
+{
+    cout << "Adaptive store: " << (chosen_ == copy_ ? "copy" : "row ids")
+         << ", hit rate " << hit_rate_ << flush << endl;
+    return chosen_->get_cache_key(table);
+}
+
+void AdaptiveJoiner::set_build_table(Table* t)
+{
+    copy_->set_build_table(t);
+    pointer_->set_build_table(t);
+}
+
+void AdaptiveJoiner::set_cache(ReuseCache* cache)
+{
+    cache_ = cache;
+}
+
+void AdaptiveJoiner::set_predicate(const IntervalSet& pred)
+{
+    copy_->set_predicate(pred);
+    pointer_->set_predicate(pred);
+}
+
+void AdaptiveJoiner::set_filter(const BuildFilter& filter)
+{
+    copy_->set_filter(filter);
+    pointer_->set_filter(filter);
+}
+
+Schema* AdaptiveJoiner::get_output_schema()
+{
+    return copy_->get_output_schema();
+}
+
+void AdaptiveJoiner::set_recorder(result_node* record)
+{
+    copy_->set_recorder(record);
+    pointer_->set_recorder(record);
+}
+
+void AdaptiveJoiner::set_aggregator(agg_node* tally)
+{
+    copy_->set_aggregator(tally);
+    pointer_->set_aggregator(tally);
+}
+
+void AdaptiveJoiner::set_output(unsigned int mode)
+{
+    BaseAlgo::set_output(mode);
+    copy_->set_output(mode);
+    pointer_->set_output(mode);
+}
+
+void AdaptiveJoiner::set_aggregate(const agg_spec& spec)
+{
+    copy_->set_aggregate(spec);
+    pointer_->set_aggregate(spec);
+}
+
+void AdaptiveJoiner::get_aggregate(agg_value& total, GroupTable& groups)
+{
+    copy_->get_aggregate(total, groups);
+    pointer_->get_aggregate(total, groups);
+}
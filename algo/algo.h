@@ -25,6 +25,67 @@
 #include "../common/lock.h"
 #include "hashtable.h"
 #include "../common/cache.h"
+#include "../common/results.h"
+#include "../common/aggregates.h"
+
+
+/** What the probe loop does with each match, see BaseAlgo::set_output(). */
+struct output_mode
+{
+    enum
+    {
+        DISCARD,    ///< nothing, matches are only found
+        ASSEMBLE,   ///< assembles the output tuple and drops it
+        WRITE,      ///< appends the output tuple to the output table
+        WRITE_NT,   ///< appends with non-temporal stores, 16-byte tuples only
+        AGGREGATE   ///< reads the aggregated columns in place, see BaseAlgo::set_aggregate()
+    };
+};
+
+/*
+ * Output sinks, one per output_mode. The probe loops take the sink as a
+ * template argument, so every mode compiles to a loop of its own without
+ * the branches of the others.
+ */
+struct DiscardSink
+{
+    static const bool ASSEMBLES = false;
+    static const bool WRITES = false;
+    static const bool AGGREGATES = false;
+    static inline void write(WriteTable* /*ret*/, void* /*tuple*/) { }
+};
+
+struct AssembleSink
+{
+    static const bool ASSEMBLES = true;
+    static const bool WRITES = false;
+    static const bool AGGREGATES = false;
+    static inline void write(WriteTable* /*ret*/, void* /*tuple*/) { }
+};
+
+struct WriteSink
+{
+    static const bool ASSEMBLES = true;
+    static const bool WRITES = true;
+    static const bool AGGREGATES = false;
+    static inline void write(WriteTable* ret, void* tuple) { ret->append(tuple); }
+};
+
+struct WriteNTSink
+{
+    static const bool ASSEMBLES = true;
+    static const bool WRITES = true;
+    static const bool AGGREGATES = false;
+    static inline void write(WriteTable* ret, void* tuple) { ret->non_temporal_append16(tuple); }
+};
+
+struct AggregateSink
+{
+    static const bool ASSEMBLES = false;
+    static const bool WRITES = false;
+    static const bool AGGREGATES = true;
+    static inline void write(WriteTable* /*ret*/, void* /*tuple*/) { }
+};
 
 
 class BaseAlgo
@@ -41,12 +102,153 @@ class BaseAlgo
         virtual void destroy();
 
         virtual void build(PageCursor* t, ht_node* node) = 0;
+
+        /**
+         * Joins \a t with the table of \a node. Returns the output, or NULL
+         * with output_mode::AGGREGATE, see set_output().
+         */
         virtual PageCursor* probe(PageCursor* t, ht_node* node) = 0;
+
+        /** Size of one hash table entry, valid after init(). */
+        virtual unsigned int get_build_tuple_size()
+        {
+            return sbuild_->get_tuple_size();
+        }
+
+        /** Bytes of the join key at the start of an entry, valid after init(). */
+        virtual unsigned int get_build_key_size()
+        {
+            return sbuild_->get_column_type_size(0);
+        }
+
+        /**
+         * Key of the cached tables this joiner can use for the table named
+         * \a table, valid after init().
+         */
+        virtual cache_key get_cache_key(const std::string& table);
+
+        /** Key of a table this joiner builds anew, see ReuseCache::insert(). */
+        virtual cache_key get_build_key(const std::string& table)
+        {
+            return get_cache_key(table);
+        }
+
+        /** Names the cache the joiner works with, for joiners that adapt to it. */
+        virtual void set_cache(ReuseCache* /*cache*/) { }
+
+        /**
+         * Selects the keys \a pred instead of [cond_s, cond_e], for range
+         * disjunctions and IN-lists. Call after init().
+         */
+        virtual void set_predicate(const IntervalSet& pred)
+        {
+            pred_ = pred;
+            cond_s_ = pred.lo();
+            cond_e_ = pred.hi();
+        }
+
+        /**
+         * Keeps only the build tuples that pass \a filter, ranges on other
+         * integer columns of the build table. Call after init().
+         */
+        virtual void set_filter(const BuildFilter& filter)
+        {
+            filter_ = filter;
+        }
+
+        /**
+         * Names the table build() reads. Called once, before the first
+         * build, cached entries may refer to its pages.
+         */
+        virtual void set_build_table(Table* /*t*/) { }
+
+        /** Schema of the output tuples, valid after init(). */
+        virtual Schema* get_output_schema() { return sout_; }
+
+        /**
+         * Makes probe() add every output tuple to \a record as well, NULL
+         * stops it. See ResultCache::record().
+         */
+        virtual void set_recorder(result_node* record) { record_ = record; }
+
+        /**
+         * Picks what probe() does with each match, one of output_mode.
+         * JoinerFactory sets it from algorithm.output.
+         */
+        virtual void set_output(unsigned int mode) { output_ = mode; }
+
+        unsigned int get_output() { return output_; }
+
+        /**
+         * Makes probe() aggregate its output as \a spec asks, see
+         * get_aggregate(). With output_mode::AGGREGATE the values are read
+         * straight from the joined tuples and no output is assembled.
+         */
+        virtual void set_aggregate(const agg_spec& spec)
+        {
+            agg_ = spec;
+            aggregating_ = true;
+        }
+
+        /**
+         * Sends the aggregates of probe() to the chunks of \a tally instead,
+         * for ungrouped queries, NULL stops it. See ChunkAggregates::record().
+         */
+        virtual void set_aggregator(agg_node* tally) { tally_ = tally; }
+
+        /**
+         * Merges what probe() aggregated since the last call into \a total,
+         * or into \a groups if the query groups, and starts afresh.
+         */
+        virtual void get_aggregate(agg_value& total, GroupTable& groups);
+
+        /**
+         * Matches probe() found since the last call, in every output mode,
+         * and the probe tuples it looked up, those inside the predicate.
+         * Starts afresh.
+         */
+        void get_matches(unsigned long long& matches, unsigned long long& probed)
+        {
+            matches = matches_;
+            probed = probed_;
+            matches_ = 0;
+            probed_ = 0;
+        }
     protected:
+        /** Adds the value \a v of an output tuple joined on \a key in \a group. */
+        inline void aggregate(unsigned long long key, long long v, long long group, agg_value& total)
+        {
+            if (tally_)
+                tally_->add(key, v);
+            else if (agg_.grouped())
+                agg_groups_.add(group, v);
+            else
+                total.add(v);
+        }
+
+        /** Integer column \a pos of the output \a tuple. */
+        inline long long output_value(void* tuple, unsigned int pos)
+        {
+            return CT_INTEGER == sout_->get_column_type(pos)
+                ? sout_->as_int(tuple, pos) : sout_->as_long(tuple, pos);
+        }
+
         Schema* s1_, * s2_, * sout_, * sbuild_;
+        Schema* sin1_;      ///< build table schema as passed to init()
         vector<unsigned int> sel1_, sel2_;
         unsigned int ja1_, ja2_, size_, selectivity_;
-        unsigned long long cond_s_, cond_e_;
+        unsigned long long cond_s_, cond_e_;   ///< smallest and largest key of pred_
+        IntervalSet pred_;  ///< keys the query selects
+        BuildFilter filter_;    ///< what the query selects of the other build columns
+        result_node* record_;   ///< where probe() records its output, or NULL
+        agg_node* tally_;       ///< where probe() aggregates its output, or NULL
+        unsigned int output_;   ///< see set_output()
+        bool aggregating_;      ///< see set_aggregate()
+        agg_spec agg_;
+        agg_value agg_total_;   ///< since the last get_aggregate(), ungrouped
+        GroupTable agg_groups_; ///< since the last get_aggregate(), grouped
+        unsigned long long matches_;    ///< see get_matches()
+        unsigned long long probed_;
 };
 
 
@@ -70,7 +272,7 @@ class HashBase : public BaseAlgo
 class StoreCopy : public HashBase
 {
     public:
-        StoreCopy(const libconfig::Setting& cfg) : HashBase(cfg) {}
+        StoreCopy(const libconfig::Setting& cfg) : HashBase(cfg), snode_(NULL) {}
         virtual ~StoreCopy() {}
 
         virtual void init(
@@ -82,23 +284,56 @@ class StoreCopy : public HashBase
         virtual void build(PageCursor* t, ht_node* node) = 0;
         virtual PageCursor* probe(PageCursor* t, ht_node* node) = 0;
 
+        /**
+         * Entries also carry the filtered columns, so that later queries
+         * with a narrower filter can check it while probing.
+         */
+        virtual void set_filter(const BuildFilter& filter);
+
+        /** The projected columns, then the filtered ones that are not. */
+        virtual cache_key get_cache_key(const std::string& table);
+
     protected:
         void buildCursor(PageCursor* t, ht_node* node,bool atomic);
 
         WriteTable* probeCursor(PageCursor* t, ht_node* node ,bool atomic, WriteTable* ret = NULL);
 
+        /**
+         * Picks the entry layout of \a node. Keys may be 32-bit offsets,
+         * see HashTable::set_key_base(), and a reused node may carry more
+         * columns than sel1_, see cache_key::covers(). snode_ is then the
+         * entry schema, and pos1_ the entry column of each of sel1_ if
+         * the columns differ. Otherwise snode_ is NULL and entries are
+         * laid out as sbuild_.
+         */
+        void bind(ht_node* node);
+
+        /** Output column \a j of the entry \a tup1, laid out as \a sentry, joined with \a tup2. */
+        inline void* column_of(Schema* sentry, void* tup1, void* tup2, unsigned int j)
+        {
+            if (j >= sel1_.size())
+                return s2_->calc_offset(tup2, sel2_[j - sel1_.size()]);
+            if (!pos1_.empty())
+                return snode_->calc_offset(tup1, pos1_[j]);
+            return s1_->calc_offset(sentry->calc_offset(tup1, 1), j);
+        }
+
+        Schema* snode_;
+        vector<unsigned int> pos1_;
+        vector<unsigned int> cols1_;    ///< entry columns after the key, see get_cache_key()
+
     private:
         template <bool atomic>
         void realbuildCursor(PageCursor* t, ht_node* node);
 
-        template <bool atomic>
+        template <bool atomic, typename Sink>
         WriteTable* realprobeCursor(PageCursor* t, ht_node* node, WriteTable* ret = NULL);
 };
 
 class StorePointer : public HashBase
 {
     public:
-        StorePointer(const libconfig::Setting& cfg) : HashBase(cfg) {}
+        StorePointer(const libconfig::Setting& cfg) : HashBase(cfg), snarrow_(NULL) {}
         virtual ~StorePointer() {}
 
         virtual void init(
@@ -110,16 +345,32 @@ class StorePointer : public HashBase
         virtual void build(PageCursor* t, ht_node* node) = 0;
         virtual PageCursor* probe(PageCursor* t, ht_node* node) = 0;
 
+        /** Entries refer to whole tuples, so every column is covered. */
+        virtual cache_key get_cache_key(const std::string& table);
+
+        virtual void set_build_table(Table* t);
+
     protected:
         void buildCursor(PageCursor* t, ht_node* node ,bool atomic);
 
         WriteTable* probeCursor(PageCursor* t, ht_node* node, bool atomic, WriteTable* ret = NULL);
 
+        /** Output column \a j of the row of the entry \a tup1, laid out as \a sentry, joined with \a tup2. */
+        inline void* column_of(Schema* sentry, void* tup1, void* tup2, unsigned int j)
+        {
+            if (j >= sel1_.size())
+                return s2_->calc_offset(tup2, sel2_[j - sel1_.size()]);
+            return s1_->calc_offset(dir_.get_tuple(sentry->as_int(tup1, 1)), sel1_[j]);
+        }
+
+        PageDirectory dir_;     ///< resolves the row ids stored in the entries
+        Schema* snarrow_;       ///< sbuild_ for tables with 32-bit keys
+
     private:
         template <bool atomic>
         void realbuildCursor(PageCursor* t, ht_node* node);
 
-        template <bool atomic>
+        template <bool atomic, typename Sink>
         WriteTable* realprobeCursor(PageCursor* t, ht_node* node ,WriteTable* ret = NULL);
 };
 
@@ -143,6 +394,71 @@ class ProbePhase : public Super
 };
 
 
+/**
+ * Joiner that keeps both stores and decides for every new table whether
+ * to copy the projected columns or to keep row ids, see choose(). Cached
+ * tables of either kind are reused, each is built and probed by the store
+ * it was made with.
+ */
+class AdaptiveJoiner : public BaseAlgo
+{
+    public:
+        AdaptiveJoiner(const libconfig::Setting& cfg);
+        virtual ~AdaptiveJoiner();
+
+        virtual void init(
+            Schema* schema1, vector<unsigned int> select1, unsigned int jattr1,
+            Schema* schema2, vector<unsigned int> select2, unsigned int jattr2,
+            unsigned int selectivity, unsigned long long cond_s, unsigned long long cond_e);
+        virtual void destroy();
+
+        virtual void build(PageCursor* t, ht_node* node);
+        virtual PageCursor* probe(PageCursor* t, ht_node* node);
+
+        virtual unsigned int get_build_tuple_size();
+        virtual unsigned int get_build_key_size();
+
+        /** Accepts tables of both stores. */
+        virtual cache_key get_cache_key(const std::string& table);
+        virtual cache_key get_build_key(const std::string& table);
+
+        virtual void set_build_table(Table* t);
+        virtual void set_cache(ReuseCache* cache);
+        virtual void set_predicate(const IntervalSet& pred);
+        virtual void set_filter(const BuildFilter& filter);
+        virtual Schema* get_output_schema();
+        virtual void set_recorder(result_node* record);
+        virtual void set_output(unsigned int mode);
+        virtual void set_aggregate(const agg_spec& spec);
+        virtual void set_aggregator(agg_node* tally);
+        virtual void get_aggregate(agg_value& total, GroupTable& groups);
+
+    private:
+        /**
+         * Picks the store for a new table. Copying is free when the
+         * projection is no wider than a row id. Otherwise row ids win
+         * when the cache is close to its byte budget, and copying wins
+         * when probe tuples match often enough that chasing row ids into
+         * the build table costs more than the extra bytes per entry, a
+         * dereference counting as DEREF_BYTES_.
+         */
+        BaseAlgo* choose();
+
+        inline BaseAlgo* store_of(ht_node* node)
+        {
+            return node->key_.store_ == cache_key::STORE_ROWIDS ? pointer_ : copy_;
+        }
+
+        static const unsigned int DEREF_BYTES_ = 64;   ///< a cache line
+        static const unsigned int BUDGET_SHARE_ = 4;   ///< row ids above 3/4 of the budget
+
+        BaseAlgo* copy_;
+        BaseAlgo* pointer_;
+        BaseAlgo* chosen_;      ///< store for tables built by this query
+        ReuseCache* cache_;
+        double hit_rate_;       ///< matches per probed tuple, recent queries
+};
+
 #include "build.inl"
 #include "probe.inl"
 
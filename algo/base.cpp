@@ -25,6 +25,7 @@ void BaseAlgo::init(Schema *schema1, vector<unsigned int> select1, unsigned int
   unsigned int jattr2, unsigned int selectivity,
   unsigned long long cond_s, unsigned long long cond_e)
 {
+    sin1_ = schema1;
     s2_ = schema2;
     sel1_ = select1;
     sel2_ = select2;
@@ -33,6 +34,8 @@ void BaseAlgo::init(Schema *schema1, vector<unsigned int> select1, unsigned int
     selectivity_ = selectivity;
     cond_s_ = cond_s;
     cond_e_ = cond_e;
+    pred_ = IntervalSet(cond_s, cond_e);
+    filter_ = BuildFilter();
 
     sout_ = new Schema();
     sbuild_ = new Schema();
@@ -62,11 +65,28 @@ void BaseAlgo::destroy()
     delete sout_;
 }
 
-BaseAlgo::BaseAlgo(const libconfig::Setting& cfg)
+cache_key BaseAlgo::get_cache_key(const string& table)
+{
+    cache_key key(table, ja1_, sel1_);
+    key.filter_ = filter_;
+    return key;
+}
+
+BaseAlgo::BaseAlgo(const libconfig::Setting& /*cfg*/)
+    : s1_(NULL), s2_(NULL), sout_(NULL), sbuild_(NULL), sin1_(NULL), record_(NULL), tally_(NULL),
+      output_(output_mode::ASSEMBLE), aggregating_(false), matches_(0), probed_(0)
 {
 
 }
 
+void BaseAlgo::get_aggregate(agg_value& total, GroupTable& groups)
+{
+    total.merge(agg_total_);
+    groups.merge(agg_groups_);
+    agg_total_ = agg_value();
+    agg_groups_.clear();
+}
+
 
 
 
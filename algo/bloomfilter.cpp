@@ -0,0 +1,86 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bloomfilter.h"
+#include <cstring>
+
+void BloomFilter::init(unsigned long long nkeys)
+{
+    if (nkeys == 0)
+        nkeys = 1;
+    capacity_ = nkeys;
+    nkeys_ = 0;
+    nblocks_ = (nkeys * BITS_PER_KEY_ + 63) / 64;
+    mapped_ = false;
+    blocks_ = new unsigned long long[nblocks_];
+    memset(blocks_, 0, nblocks_ * sizeof(unsigned long long));
+}
+
+void BloomFilter::destroy()
+{
+    if (!mapped_)
+        delete[] blocks_;
+    blocks_ = 0;
+    nblocks_ = 0;
+}
+
+void BloomFilter::clone(BloomFilter* src)
+{
+    capacity_ = src->capacity_;
+    nkeys_ = src->nkeys_;
+    nblocks_ = src->nblocks_;
+    mapped_ = false;
+    blocks_ = new unsigned long long[nblocks_];
+    memcpy(blocks_, src->blocks_, nblocks_ * sizeof(unsigned long long));
+}
+
+void BloomFilter::serialize(char* image)
+{
+    unsigned long long* hdr = (unsigned long long*)image;
+    hdr[0] = capacity_;
+    hdr[1] = nkeys_;
+    hdr[2] = nblocks_;
+    memcpy(hdr + 3, blocks_, get_size());
+}
+
+bool BloomFilter::attach(char* image, unsigned long long len)
+{
+    unsigned long long* hdr = (unsigned long long*)image;
+    if (len < 3 * sizeof(unsigned long long) || hdr[2] == 0
+            || hdr[2] > (len - 3 * sizeof(unsigned long long)) / sizeof(unsigned long long))
+        return false;
+    capacity_ = hdr[0];
+    nkeys_ = hdr[1];
+    nblocks_ = hdr[2];
+    blocks_ = hdr + 3;
+    mapped_ = true;
+    return true;
+}
+
+double BloomFilter::false_positive_rate()
+{
+    double sum = 0;
+    for (unsigned long long i = 0; i < nblocks_; ++i)
+    {
+        double fill = __builtin_popcountll(blocks_[i]) / 64.0;
+        double p = 1;
+        for (unsigned int k = 0; k < HASHES_; ++k)
+            p *= fill;
+        sum += p;
+    }
+    return nblocks_ ? sum / nblocks_ : 0;
+}
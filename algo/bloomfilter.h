@@ -0,0 +1,123 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+/**
+ * Register-blocked Bloom filter over the 32-bit hash of the join key.
+ * All bits of a key live in one 64-bit word, so a lookup is a single load
+ * and a mask compare.
+ */
+class BloomFilter
+{
+    public:
+        /** Sizes the filter for \a nkeys keys. */
+        void init(unsigned long long nkeys);
+        void destroy();
+
+        /** Initializes this filter as a copy of \a src. */
+        void clone(BloomFilter* src);
+
+        /** Bytes serialize() writes. */
+        inline unsigned long long get_image_size()
+        {
+            return 3 * sizeof(unsigned long long) + get_size();
+        }
+
+        /** Writes the filter to \a image: capacity, keys, blocks, bits. */
+        void serialize(char* image);
+
+        /**
+         * Initializes this filter on an image written by serialize(), using
+         * the bits in place. destroy() leaves the image alone. Returns
+         * false if the image does not fit in its \a len bytes.
+         */
+        bool attach(char* image, unsigned long long len);
+
+        inline void add(unsigned int hash)
+        {
+            unsigned long long m = mix(hash);
+            blocks_[block(m)] |= mask(m);
+            ++nkeys_;
+        }
+
+        inline void atomic_add(unsigned int hash)
+        {
+            unsigned long long m = mix(hash);
+            __sync_fetch_and_or(&blocks_[block(m)], mask(m));
+            __sync_fetch_and_add(&nkeys_, 1);
+        }
+
+        inline bool contains(unsigned int hash)
+        {
+            unsigned long long m = mix(hash);
+            unsigned long long bits = mask(m);
+            return (blocks_[block(m)] & bits) == bits;
+        }
+
+        /** Number of keys the filter was sized for. */
+        inline unsigned long long get_capacity()
+        {
+            return capacity_;
+        }
+
+        inline unsigned long long get_key_num()
+        {
+            return nkeys_;
+        }
+
+        /** Bytes used by the bit array. */
+        inline unsigned long long get_size()
+        {
+            return nblocks_ * sizeof(unsigned long long);
+        }
+
+        /**
+         * Expected false-positive rate, from the fill of every block:
+         * a key maps to one block and hits when all its bits are set there.
+         */
+        double false_positive_rate();
+
+    private:
+        inline unsigned long long mix(unsigned int hash)
+        {
+            return (unsigned long long)hash * 0x9E3779B97F4A7C15ULL;
+        }
+
+        inline unsigned int block(unsigned long long m)
+        {
+            return (unsigned int)(((m >> 32) * nblocks_) >> 32);
+        }
+
+        inline unsigned long long mask(unsigned long long m)
+        {
+            return (1ULL << (m & 63)) | (1ULL << ((m >> 6) & 63))
+                 | (1ULL << ((m >> 12) & 63)) | (1ULL << ((m >> 18) & 63));
+        }
+
+        unsigned long long* blocks_;
+        unsigned long long nblocks_;
+        unsigned long long capacity_;
+        unsigned long long nkeys_;
+        bool mapped_;
+
+        static const unsigned int BITS_PER_KEY_ = 8;
+        static const unsigned int HASHES_ = 4;
+};
+
+#endif // BLOOMFILTER_H
@@ -0,0 +1,255 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "frozentable.h"
+#include "../common/hash.h"
+#include "bzlib.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+typedef pair<unsigned long long, const char*> keyed_entry;
+
+static bool key_less(const keyed_entry& a, const keyed_entry& b)
+{
+    return a.first < b.first;
+}
+
+static void put_varint(vector<char>& out, unsigned long long v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static unsigned long long get_varint(const char*& in)
+{
+    unsigned long long v = 0;
+    unsigned int shift = 0;
+    unsigned char c;
+    do
+    {
+        c = *in++;
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return v;
+}
+
+static unsigned int bit_width(unsigned long long v)
+{
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+void FrozenTable::freeze(HashTable* table)
+{
+    tuplesize_ = table->get_tuple_size();
+    bucksize_ = table->get_bucket_size();
+    key_width_ = table->get_key_width();
+    hash_width_ = table->get_hash_width();
+    key_base_ = table->get_key_base();
+    ntuples_ = 0;
+    deep_ = false;
+
+    vector<keyed_entry> entries;
+    entries.reserve(table->get_tuple_num());
+    HashTable::Iterator it = table->create_iterator();
+    for (unsigned int i = 0; i < table->get_bucket_num(); ++i)
+    {
+        void* tup;
+        table->place_iterator(it, i);
+        while ((tup = it.read_next()))
+            entries.push_back(keyed_entry(table->get_key(tup), (const char*)tup));
+    }
+    sort(entries.begin(), entries.end(), key_less);
+    ntuples_ = entries.size();
+
+    unsigned int words = (tuplesize_ - key_width_) / sizeof(unsigned long long);
+    unsigned int tail = (tuplesize_ - key_width_) % sizeof(unsigned long long);
+    vector<char> out;
+    for (unsigned long long b = 0; b < entries.size(); b += BLOCK_)
+    {
+        unsigned long long e = b + BLOCK_ < entries.size() ? b + BLOCK_ : entries.size();
+
+        unsigned long long prev = 0;
+        for (unsigned long long i = b; i < e; ++i)
+        {
+            put_varint(out, entries[i].first - prev);
+            prev = entries[i].first;
+        }
+
+        for (unsigned int w = 0; w < words; ++w)
+        {
+            unsigned int off = key_width_ + sizeof(unsigned long long) * w;
+            unsigned long long lo = ~0ULL, hi = 0;
+            for (unsigned long long i = b; i < e; ++i)
+            {
+                unsigned long long v;
+                memcpy(&v, entries[i].second + off, sizeof(v));
+                lo = v < lo ? v : lo;
+                hi = v > hi ? v : hi;
+            }
+            unsigned int bits = bit_width(hi - lo);
+            put_varint(out, lo);
+            out.push_back((char)bits);
+
+            unsigned long long acc = 0;
+            unsigned int nacc = 0;
+            for (unsigned long long i = b; i < e; ++i)
+            {
+                unsigned long long v;
+                memcpy(&v, entries[i].second + off, sizeof(v));
+                v -= lo;
+                for (unsigned int k = 0; k < bits; ++k)
+                {
+                    acc |= ((v >> k) & 1) << nacc;
+                    if (++nacc == 8)
+                    {
+                        out.push_back((char)acc);
+                        acc = 0;
+                        nacc = 0;
+                    }
+                }
+            }
+            if (nacc)
+                out.push_back((char)acc);
+        }
+
+        for (unsigned long long i = b; i < e && tail; ++i)
+            out.insert(out.end(), entries[i].second + tuplesize_ - tail, entries[i].second + tuplesize_);
+    }
+
+    size_ = raw_size_ = out.size();
+    data_ = new char[size_ ? size_ : 1];
+    if (size_)
+        memcpy(data_, &out[0], size_);
+}
+
+bool FrozenTable::deep_freeze()
+{
+    if (deep_ || size_ == 0)
+        return false;
+    // bzip2 worst case is 1% plus 600 bytes larger
+    unsigned int len = raw_size_ + raw_size_ / 100 + 601;
+    char* buf = new char[len];
+    if (BZ2_bzBuffToBuffCompress(buf, &len, data_, raw_size_, 9, 0, 0) != BZ_OK || len >= size_)
+    {
+        delete[] buf;
+        return false;
+    }
+    delete[] data_;
+    data_ = new char[len];
+    memcpy(data_, buf, len);
+    delete[] buf;
+    size_ = len;
+    deep_ = true;
+    return true;
+}
+
+bool FrozenTable::thaw(HashTable* table, BloomFilter* bloom)
+{
+    const char* in = data_;
+    char* raw = 0;
+    if (deep_)
+    {
+        unsigned int len = raw_size_;
+        raw = new char[raw_size_];
+        if (BZ2_bzBuffToBuffDecompress(raw, &len, data_, size_, 0, 0) != BZ_OK || len != raw_size_)
+        {
+            delete[] raw;
+            return false;
+        }
+        in = raw;
+    }
+
+    table->init(ntuples_ / 2, bucksize_, tuplesize_);
+    if (key_width_ != sizeof(unsigned long long))
+        table->set_key_base(key_base_);
+    table->set_hash_width(hash_width_);
+    bloom->init(ntuples_);
+
+    unsigned int words = (tuplesize_ - key_width_) / sizeof(unsigned long long);
+    unsigned int tail = (tuplesize_ - key_width_) % sizeof(unsigned long long);
+    vector<unsigned long long> keys(BLOCK_);
+    vector<char> block((unsigned long long)BLOCK_ * tuplesize_);
+    for (unsigned long long b = 0; b < ntuples_; b += BLOCK_)
+    {
+        unsigned long long n = b + BLOCK_ < ntuples_ ? BLOCK_ : ntuples_ - b;
+        char* entry = &block[0];
+
+        unsigned long long key = 0;
+        for (unsigned long long i = 0; i < n; ++i)
+        {
+            key += get_varint(in);
+            keys[i] = key;
+            table->put_key(entry + i * tuplesize_, key);
+        }
+
+        for (unsigned int w = 0; w < words; ++w)
+        {
+            unsigned int off = key_width_ + sizeof(unsigned long long) * w;
+            unsigned long long lo = get_varint(in);
+            unsigned int bits = (unsigned char)*in++;
+            unsigned int nacc = 0;
+            for (unsigned long long i = 0; i < n; ++i)
+            {
+                unsigned long long v = 0;
+                for (unsigned int k = 0; k < bits; ++k)
+                {
+                    v |= (unsigned long long)((*in >> nacc) & 1) << k;
+                    if (++nacc == 8)
+                    {
+                        ++in;
+                        nacc = 0;
+                    }
+                }
+                v += lo;
+                memcpy(entry + i * tuplesize_ + off, &v, sizeof(v));
+            }
+            if (nacc)
+                ++in;
+        }
+
+        for (unsigned long long i = 0; i < n && tail; ++i)
+        {
+            memcpy(entry + (i + 1) * tuplesize_ - tail, in, tail);
+            in += tail;
+        }
+
+        for (unsigned long long i = 0; i < n; ++i)
+        {
+            HashTable::hash_t hash = table->hash(keys[i]);
+            table->insert(hash, entry + i * tuplesize_);
+            bloom->add(hash);
+        }
+    }
+    delete[] raw;
+    return true;
+}
+
+void FrozenTable::destroy()
+{
+    delete[] data_;
+    data_ = 0;
+    size_ = 0;
+}
@@ -0,0 +1,93 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FROZENTABLE_H
+#define FROZENTABLE_H
+
+#include "hashtable.h"
+#include "bloomfilter.h"
+
+/**
+ * Compressed, read-only form of a cached hash table for cold nodes. It
+ * cannot be probed; thaw() rebuilds a probe-ready table from it.
+ *
+ * Entries are sorted by their key and cut into blocks of BLOCK_ entries.
+ * In a block the keys are varint deltas from the previous key, and every
+ * 8-byte column of the entry after the key is stored frame of
+ * reference: the block minimum, then each value minus it, bit-packed at
+ * the width of the largest. Trailing bytes of odd-sized entries are kept
+ * raw. deep_freeze() additionally runs the whole stream through bzip2.
+ */
+class FrozenTable
+{
+    public:
+        FrozenTable()
+            : data_(0), size_(0), raw_size_(0), ntuples_(0), tuplesize_(0), bucksize_(0),
+              key_width_(0), hash_width_(0), key_base_(0), deep_(false)
+        { }
+
+        /** Encodes all entries of \a table, see HashTable::get_key(). */
+        void freeze(HashTable* table);
+
+        /**
+         * Compresses the encoded stream with bzip2, for the coldest nodes.
+         * Returns false, and leaves the table as it was, if that does not
+         * make it smaller.
+         */
+        bool deep_freeze();
+
+        /**
+         * Initializes \a table and \a bloom with the frozen entries. Returns
+         * false, leaving both uninitialized, if the bzip2 stream does not
+         * decompress to the encoded size.
+         */
+        bool thaw(HashTable* table, BloomFilter* bloom);
+
+        void destroy();
+
+        /** Bytes held now. */
+        inline unsigned long long get_size()
+        {
+            return size_;
+        }
+
+        inline unsigned long long get_tuple_num()
+        {
+            return ntuples_;
+        }
+
+        inline bool is_deep()
+        {
+            return deep_;
+        }
+
+    private:
+        static const unsigned int BLOCK_ = 128;
+
+        char* data_;
+        unsigned long long size_;
+        unsigned long long raw_size_;   ///< of the stream before bzip2
+        unsigned long long ntuples_;
+        unsigned int tuplesize_;
+        unsigned int bucksize_;
+        unsigned int key_width_;
+        unsigned int hash_width_;
+        unsigned long long key_base_;
+        bool deep_;
+};
+
+#endif // FROZENTABLE_H
@@ -38,16 +38,3 @@ void HashBase::destroy()
 {
     BaseAlgo::destroy();
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -17,115 +17,538 @@
 
 #include "hashtable.h"
 #include "../common/exceptions.h"
+#include <cstring>
 
 void HashTable::init(unsigned int nbuckets, unsigned int bucksize, unsigned int tuplesize)
 {
-    lock_ = new Lock[nbuckets];
-    bucket_ = (void**)new char[sizeof(void*) * nbuckets];
-    for (int i=0; i<nbuckets; ++i) {
-        // allocating space for data + free pointer + next pointer
-        bucket_[i] = new char[bucksize + 2*sizeof(void*)];
-        void** free = (void**)(((char*)bucket_[i]) + bucksize);
-        void** next = (void**)(((char*)bucket_[i]) + bucksize + sizeof(void*));
-        *next = 0;
-        *free = bucket_[i];
-    }
-
-    this->bucksize_ = bucksize;
+    // a page holds at least one tuple
+    this->bucksize_ = bucksize < tuplesize ? tuplesize : bucksize;
     this->tuplesize_ = tuplesize;
-    this->nbuckets_ = nbuckets;
+    this->n0_ = nbuckets ? nbuckets : 1;
+    this->state_ = 0;
+    this->ntuples_ = 0;
+    this->slots_ = bucksize_ / tuplesize;
+    // one tag per slot, padded so that the data stays pointer-aligned
+    this->tagsize_ = (slots_ * sizeof(tag_t) + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
     this->start_value_ = 0;
     this->end_value_ = 0;
+    this->key_base_ = 0;
+    this->key_width_ = sizeof(unsigned long long);
+    this->hash_width_ = sizeof(unsigned long long);
+    this->mapped_ = false;
+    resize_lock_.unlock();
+
+    clear_directory();
+    add_segment(0);
+    for (unsigned int i=0; i<n0_; ++i) {
+        dir_[0].heads_[i] = new_page();
+    }
 }
 
 
 void HashTable::destroy()
 {
-    for (int i=0; i<nbuckets_; ++i) {
-        void* tmp = bucket_[i];
-        void* cur = *(void**)(((char*)bucket_[i]) + bucksize_ + sizeof(void*));
+    for (unsigned int hi=0; hi<dirsize_; ++hi) {
+        if (!dir_[hi].heads_)
+            continue;
+        delete[] dir_[hi].locks_;
+        release_segment(dir_[hi].heads_, dir_[hi].refs_);
+    }
+    delete[] dir_;
+    for (unsigned int i=0; i<old_dirs_.size(); ++i) {
+        delete[] old_dirs_[i];
+    }
+    old_dirs_.clear();
+    clear_directory();
+}
+
+void HashTable::release_segment(void** heads, volatile unsigned int* refs)
+{
+    if (__sync_sub_and_fetch(refs, 1) != 0)
+        return;
+    delete refs;
+    if (mapped_) {
+        // pages and heads belong to the image
+        return;
+    }
+    for (unsigned int i=0; i<n0_; ++i) {
+        void* cur = heads[i];
         while (cur) {
+            void* tmp = cur;
+            cur = page_next(cur);
             delete[] (char*)tmp;
-            tmp = cur;
-            cur = *(void**)(((char*)cur) + bucksize_ + sizeof(void*));
         }
-        delete[] (char*) tmp;
     }
-
-    delete[] lock_;
-    delete[] (char*) bucket_;
+    delete[] heads;
 }
 
-void* HashTable::allocate(unsigned int offset)
+void HashTable::clone(HashTable* src)
 {
-#ifdef DEBUG
-    assert(0 <= offset && offset<nbuckets_);
-#endif
-    void* data = bucket_[offset];
-    void** freeloc = (void**)((char*)data + bucksize_);
-    void* ret;
-    if ((*freeloc) <= ((char*)data + bucksize_ - tuplesize_)) {
-        // Fast path: it fits!
-        //
-        ret = *freeloc;
-        *freeloc = ((char*)(*freeloc)) + tuplesize_;
-        return ret;
+    this->bucksize_ = src->bucksize_;
+    this->tuplesize_ = src->tuplesize_;
+    this->n0_ = src->n0_;
+    this->state_ = src->state_;
+    this->ntuples_ = src->ntuples_;
+    this->slots_ = src->slots_;
+    this->tagsize_ = src->tagsize_;
+    this->start_value_ = src->start_value_;
+    this->end_value_ = src->end_value_;
+    this->key_base_ = src->key_base_;
+    this->key_width_ = src->key_width_;
+    this->hash_width_ = src->hash_width_;
+    this->mapped_ = false;
+    resize_lock_.unlock();
+
+    clear_directory();
+    for (unsigned int hi=0; hi<src->dirsize_; ++hi) {
+        if (!src->dir_[hi].heads_)
+            continue;
+        if (src->mapped_) {
+            // the image goes away with src
+            add_segment(hi, copy_heads(src->dir_[hi].heads_));
+            continue;
+        }
+        __sync_fetch_and_add(src->dir_[hi].refs_, 1);
+        add_segment(hi, src->dir_[hi].heads_, src->dir_[hi].refs_);
     }
-
-    // Allocate new page and make bucket[offset] point to it.
-    //
-    //throw PageFullException(offset);
-
-    ret = new char[bucksize_ + 2*sizeof(void*)];
-    bucket_[offset] = ret;
-
-    void** nextloc = (void**)(((char*)ret) + bucksize_ + sizeof(void*));
-    *nextloc = data;
-
-    freeloc = (void**)(((char*)ret) + bucksize_);
-    *freeloc = ((char*)ret) + tuplesize_; ///<point to the left of bucksize
-
-    return ret;
 }
 
-HashTable::Iterator HashTable::create_iterator()
+void** HashTable::copy_heads(void** heads)
 {
-    return Iterator(bucksize_,tuplesize_);
+    void** copy = new void*[n0_];
+    for (unsigned int i=0; i<n0_; ++i) {
+        // copy the chain page by page, keeping its order
+        void** tail = &copy[i];
+        for (void* cur = heads[i]; cur; cur = page_next(cur)) {
+            void* page = new char[page_size()];
+            memcpy(page, cur, page_size());
+            *tail = page;
+            tail = &page_next(page);
+        }
+        *tail = 0;
+    }
+    return copy;
 }
 
-
-HashTable::Iterator::Iterator(unsigned int bucksize, unsigned int tuplesize)
-    : bucksize_(bucksize), tuplesize_(tuplesize), cur_(0), free_(0), next_(0)
+void HashTable::unshare(unsigned int hi)
 {
-
+    void** heads = dir_[hi].heads_;
+    volatile unsigned int* refs = dir_[hi].refs_;
+    // writers check refs_ and then load heads_
+    dir_[hi].heads_ = copy_heads(heads);
+    __sync_synchronize();
+    dir_[hi].refs_ = new unsigned int(1);
+    release_segment(heads, refs);
 }
 
+void HashTable::clone(HashTable* src, unsigned long long lo, unsigned long long hi)
+{
+    this->bucksize_ = src->bucksize_;
+    this->tuplesize_ = src->tuplesize_;
+    this->n0_ = src->n0_;
+    this->ntuples_ = 0;
+    this->slots_ = src->slots_;
+    this->tagsize_ = src->tagsize_;
+    this->start_value_ = src->start_value_;
+    this->end_value_ = src->end_value_;
+    this->key_base_ = src->key_base_;
+    this->key_width_ = src->key_width_;
+    this->hash_width_ = src->hash_width_;
+    this->mapped_ = false;
+    resize_lock_.unlock();
+
+    Iterator it = src->create_iterator();
+    unsigned long long kept = 0;
+    for (unsigned int s=0; s<src->dirsize_; ++s) {
+        if (!src->dir_[s].heads_)
+            continue;
+        for (unsigned int i=0; i<n0_; ++i) {
+            if (!src->dir_[s].heads_[i])
+                continue;
+            src->start_iterator(it, src->dir_[s].heads_[i]);
+            void* tup;
+            while ((tup = it.read_next())) {
+                unsigned long long key = src->get_key(tup);
+                kept += key >= lo && key <= hi;
+            }
+        }
+    }
 
+    // Fewest segments that hold the kept entries. Below the source level,
+    // segment s folds into s & (2^level - 1): an entry's low directory
+    // bits name its segment, so it still needs no rehashing.
+    unsigned int level = 0;
+    while (level < level_of(src->state_) && kept > ((unsigned long long)slots_ * n0_ << level))
+        ++level;
+    bool fold = level < level_of(src->state_);
+    this->state_ = fold ? (unsigned long long)level << 32 : src->state_;
+    unsigned int mask = (1u << level) - 1;
+
+    clear_directory();
+    for (unsigned int s=0; s<src->dirsize_; ++s) {
+        if (!src->dir_[s].heads_)
+            continue;
+        unsigned int d = fold ? s & mask : s;
+        if (d >= dirsize_ || !dir_[d].heads_)
+            add_segment(d);
+        for (unsigned int i=0; i<n0_; ++i) {
+            if (!src->dir_[s].heads_[i])
+                continue;
+            src->start_iterator(it, src->dir_[s].heads_[i]);
+            void* tup;
+            while ((tup = it.read_next())) {
+                unsigned long long key = src->get_key(tup);
+                if (key < lo || key > hi)
+                    continue;
+                // pages only for buckets that keep an entry
+                if (!dir_[d].heads_[i])
+                    dir_[d].heads_[i] = new_page();
+                memcpy(place(dir_[d].heads_[i], it.last_tag()), tup, tuplesize_);
+                ++ntuples_;
+            }
+        }
+    }
+}
 
+void HashTable::get_chain_stats(unsigned long long& pages, unsigned long long& chains)
+{
+    pages = 0;
+    chains = 0;
+    for (unsigned int s=0; s<dirsize_; ++s) {
+        if (!dir_[s].heads_)
+            continue;
+        for (unsigned int i=0; i<n0_; ++i) {
+            void* page = dir_[s].heads_[i];
+            if (page)
+                ++chains;
+            for (; page; page = page_next(page))
+                ++pages;
+        }
+    }
+}
 
+unsigned long long HashTable::get_size()
+{
+    unsigned long long pages, chains, nsegs = 0;
+    get_chain_stats(pages, chains);
+    for (unsigned int s=0; s<dirsize_; ++s) {
+        if (dir_[s].heads_)
+            ++nsegs;
+    }
+    return pages * page_size() + nsegs * n0_ * (sizeof(void*) + sizeof(Lock))
+        + dirsize_ * (sizeof(void**) + sizeof(Lock*));
+}
 
+unsigned long long HashTable::get_image_size()
+{
+    unsigned long long pages, chains, nsegs = 0;
+    get_chain_stats(pages, chains);
+    for (unsigned int s=0; s<dirsize_; ++s) {
+        if (dir_[s].heads_)
+            ++nsegs;
+    }
+    return sizeof(Image) + (dirsize_ + nsegs * n0_) * sizeof(unsigned long long) + pages * page_stride();
+}
 
+void HashTable::serialize(char* image)
+{
+    Image* hdr = (Image*)image;
+    hdr->tuplesize_ = tuplesize_;
+    hdr->bucksize_ = bucksize_;
+    hdr->tagsize_ = tagsize_;
+    hdr->slots_ = slots_;
+    hdr->n0_ = n0_;
+    hdr->key_width_ = key_width_;
+    hdr->hash_width_ = hash_width_;
+    hdr->nsegs_ = dirsize_;
+    hdr->state_ = state_;
+    hdr->ntuples_ = ntuples_;
+    hdr->start_value_ = start_value_;
+    hdr->end_value_ = end_value_;
+    hdr->key_base_ = key_base_;
+
+    unsigned long long* dir = (unsigned long long*)(image + sizeof(Image));
+    unsigned long long off = sizeof(Image) + dirsize_ * sizeof(unsigned long long);
+    for (unsigned int s=0; s<dirsize_; ++s) {
+        dir[s] = dir_[s].heads_ ? off : 0;
+        if (dir_[s].heads_)
+            off += n0_ * sizeof(unsigned long long);
+    }
 
+    for (unsigned int s=0; s<dirsize_; ++s) {
+        if (!dir_[s].heads_)
+            continue;
+        unsigned long long* heads = (unsigned long long*)(image + dir[s]);
+        for (unsigned int i=0; i<n0_; ++i) {
+            heads[i] = 0;
+            unsigned long long* link = &heads[i];
+            for (void* page = dir_[s].heads_[i]; page; page = page_next(page)) {
+                char* dst = image + off;
+                memcpy(dst, page, page_size());
+                *link = off;
+                link = (unsigned long long*)&page_next(dst);
+                *link = 0;
+                off += page_stride();
+            }
+        }
+    }
+}
 
+bool HashTable::check_image(const char* image, unsigned long long len)
+{
+    if (len < sizeof(Image))
+        return false;
+    const Image* hdr = (const Image*)image;
+    if (hdr->tuplesize_ == 0 || hdr->slots_ == 0 || hdr->slots_ != hdr->bucksize_ / hdr->tuplesize_
+            || hdr->tagsize_ != ((hdr->slots_ * sizeof(tag_t) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+            || hdr->n0_ == 0 || (hdr->key_width_ != sizeof(int) && hdr->key_width_ != sizeof(unsigned long long))
+            || hdr->hash_width_ == 0 || hdr->hash_width_ > sizeof(unsigned long long)
+            || ((unsigned long long)hdr->n0_ << level_of(hdr->state_)) > MAX_BUCKETS_
+            || split_of(hdr->state_) >= (hdr->n0_ << level_of(hdr->state_))
+            || hdr->nsegs_ > (len - sizeof(Image)) / sizeof(unsigned long long))
+        return false;
+
+    // page_size() and page_in_image() read the geometry from the members
+    this->tuplesize_ = hdr->tuplesize_;
+    this->bucksize_ = hdr->bucksize_;
+    this->tagsize_ = hdr->tagsize_;
+    this->slots_ = hdr->slots_;
+    // segments below the split pointer's target must all be there
+    const unsigned long long* dir = (const unsigned long long*)(image + sizeof(Image));
+    unsigned int split = split_of(hdr->state_);
+    unsigned long long nsegs = (1ULL << level_of(hdr->state_)) + (split ? (split - 1) / hdr->n0_ + 1 : 0);
+    if (nsegs > hdr->nsegs_)
+        return false;
+    for (unsigned int s=0; s<nsegs; ++s) {
+        if (!dir[s])
+            return false;
+    }
 
+    // every page is visited once at most, so a cycle runs out of pages
+    unsigned long long pages = len / page_stride();
+    for (unsigned int s=0; s<hdr->nsegs_; ++s) {
+        unsigned long long off = dir[s];
+        if (!off)
+            continue;
+        if (off < sizeof(Image) || off % sizeof(unsigned long long) != 0 || off > len
+                || (len - off) / sizeof(unsigned long long) < hdr->n0_)
+            return false;
+        const unsigned long long* heads = (const unsigned long long*)(image + off);
+        for (unsigned int i=0; i<hdr->n0_; ++i) {
+            for (unsigned long long page = heads[i]; page;
+                    page = *(const unsigned long long*)(image + page + tagsize_ + bucksize_ + sizeof(void*))) {
+                if (!page_in_image(page, len) || pages-- == 0
+                        || *(const unsigned long*)(image + page + tagsize_ + bucksize_) > slots_)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
 
+bool HashTable::attach(char* image, unsigned long long len)
+{
+    if (!check_image(image, len))
+        return false;
+    Image* hdr = (Image*)image;
+    this->tuplesize_ = hdr->tuplesize_;
+    this->bucksize_ = hdr->bucksize_;
+    this->tagsize_ = hdr->tagsize_;
+    this->slots_ = hdr->slots_;
+    this->n0_ = hdr->n0_;
+    this->state_ = hdr->state_;
+    this->ntuples_ = hdr->ntuples_;
+    this->start_value_ = hdr->start_value_;
+    this->end_value_ = hdr->end_value_;
+    this->key_base_ = hdr->key_base_;
+    this->key_width_ = hdr->key_width_;
+    this->hash_width_ = hdr->hash_width_;
+    this->mapped_ = true;
+    resize_lock_.unlock();
+
+    // swizzle offsets into pointers, the heads double as the segments
+    const unsigned long long* dir = (const unsigned long long*)(image + sizeof(Image));
+    clear_directory();
+    for (unsigned int s=0; s<hdr->nsegs_; ++s) {
+        if (!dir[s])
+            continue;
+        unsigned long long* heads = (unsigned long long*)(image + dir[s]);
+        for (unsigned int i=0; i<n0_; ++i) {
+            void** link = (void**)&heads[i];
+            while (*(unsigned long long*)link) {
+                *link = image + *(unsigned long long*)link;
+                link = &page_next(*link);
+            }
+        }
+        add_segment(s, (void**)heads);
+    }
+    return true;
+}
 
+void HashTable::add_segment(unsigned int hi, void** heads, volatile unsigned int* refs)
+{
+    if (hi >= dirsize_) {
+        unsigned int size = dirsize_ ? dirsize_ : 1;
+        while (size <= hi)
+            size *= 2;
+        Segment* dir = new Segment[size];
+        for (unsigned int s=0; s<size; ++s) {
+            if (s < dirsize_) {
+                dir[s] = dir_[s];
+            } else {
+                dir[s].heads_ = 0;
+                dir[s].locks_ = 0;
+                dir[s].refs_ = 0;
+            }
+        }
+        if (dir_) {
+            Segment* old = dir_;
+            old_dirs_.push_back(old);
+        }
+        // a reader loads the state first, and no state refers to the new
+        // slots before the directory is in place
+        dir_ = dir;
+        dirsize_ = size;
+    }
+    if (!heads) {
+        // heads stay NULL until the matching bucket of the lower half splits
+        heads = new void*[n0_];
+        for (unsigned int i=0; i<n0_; ++i) {
+            heads[i] = 0;
+        }
+    }
+    dir_[hi].locks_ = new Lock[n0_];
+    dir_[hi].refs_ = refs ? refs : new unsigned int(1);
+    dir_[hi].heads_ = heads;
+}
 
+void HashTable::clear_directory()
+{
+    dir_ = 0;
+    dirsize_ = 0;
+}
 
+void* HashTable::new_page()
+{
+    void* page = new char[page_size()];
+    page_used(page) = 0;
+    page_next(page) = 0;
+    return page;
+}
 
+void* HashTable::place(void*& head, tag_t tag)
+{
+#ifdef DEBUG
+    assert(slots_ > 0);
+#endif
+    // an empty bucket may have no page yet, see clone(src, lo, hi)
+    void* page = head;
+    if (page && page_used(page) < slots_) {
+        // Fast path: it fits!
+        //
+        unsigned long slot = page_used(page)++;
+        ((tag_t*)page)[slot] = tag;
+        return page_data(page) + slot * tuplesize_;
+    }
 
+    // Allocate new page and make the bucket point to it.
+    //
+    //throw PageFullException(offset);
 
+    void* ret = new char[page_size()];
+    page_next(ret) = page;
+    page_used(ret) = 1;
+    ((tag_t*)ret)[0] = tag;
+    head = ret;
 
+    return page_data(ret);
+}
 
+void HashTable::split_chain(void*& src, void*& dst, unsigned int bit)
+{
+    void* stay = new_page();
+    void* move = new_page();
+    Iterator it = create_iterator();
+    start_iterator(it, src);
+    void* tup;
+    while ((tup = it.read_next())) {
+        // the tag holds none of the directory bits, the key is rehashed
+        tag_t tag = it.last_tag();
+        void* target = place((dir_bits(hash(get_key(tup))) >> bit) & 1 ? move : stay, tag);
+        memcpy(target, tup, tuplesize_);
+    }
 
+    void* old = src;
+    dst = move;
+    src = stay;
+    while (old) {
+        void* tmp = old;
+        old = page_next(old);
+        delete[] (char*)tmp;
+    }
+}
 
+void HashTable::split()
+{
+    unsigned long long state = state_;
+    unsigned int level = level_of(state);
+    unsigned int split = split_of(state);
+    unsigned int hi = split / n0_;
+    unsigned int lo = split % n0_;
+    unsigned int newhi = hi + (1u << level);
+
+    if (newhi >= dirsize_ || !dir_[newhi].heads_)
+        add_segment(newhi);
+    else if (shared(newhi))
+        unshare(newhi);
+    if (shared(hi))
+        unshare(hi);
+    split_chain(dir_[hi].heads_[lo], dir_[newhi].heads_[lo], level);
+
+    if (++split == (n0_ << level))
+        state_ = (unsigned long long)(level + 1) << 32;
+    else
+        state_ = ((unsigned long long)level << 32) | split;
+}
 
+void HashTable::atomic_split()
+{
+    unsigned long long state = state_;
+    unsigned int level = level_of(state);
+    unsigned int split = split_of(state);
+    unsigned int hi = split / n0_;
+    unsigned int lo = split % n0_;
+    unsigned int newhi = hi + (1u << level);
+
+    // no writer is in a shared segment, they wait for the resize lock
+    if (newhi >= dirsize_ || !dir_[newhi].heads_)
+        add_segment(newhi);
+    else if (shared(newhi))
+        unshare(newhi);
+    if (shared(hi))
+        unshare(hi);
+    __sync_synchronize();
+
+    // writers of the source wait here and recheck the state afterwards;
+    // the target is unreachable until the new state is published
+    dir_[hi].locks_[lo].lock();
+    split_chain(dir_[hi].heads_[lo], dir_[newhi].heads_[lo], level);
+    __sync_synchronize();
+    if (++split == (n0_ << level))
+        state_ = (unsigned long long)(level + 1) << 32;
+    else
+        state_ = ((unsigned long long)level << 32) | split;
+    dir_[hi].locks_[lo].unlock();
+}
 
+HashTable::Iterator HashTable::create_iterator()
+{
+    return Iterator(tagsize_,bucksize_,tuplesize_);
+}
 
 
+HashTable::Iterator::Iterator(unsigned int tagsize, unsigned int bucksize, unsigned int tuplesize)
+    : page_(0), slot_(0), used_(0), tagsize_(tagsize), bucksize_(bucksize), tuplesize_(tuplesize)
+{
 
-
-
-
-
-
+}
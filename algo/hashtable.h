@@ -19,18 +19,136 @@
 #define HASHTABLE_H
 
 #include "../common/lock.h"
+#include "../common/hash.h"
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
+/**
+ * Chained hash table with fixed-size bucket pages.
+ *
+ * Every page is laid out as
+ *
+ *     [tag array][tuple data, bucksize bytes][used slots][next page]
+ *
+ * The tag array holds one 16-bit fingerprint per tuple slot, so a probe
+ * can reject non-matching entries of a chain without touching their data.
+ *
+ * The table grows by linear hashing. Buckets live in segments of n0
+ * buckets each; segment 0 is created by init(). Hashes are 64 bits wide:
+ * the low half picks the bucket and the tag, the high half the segment.
+ * At level L a key goes to bucket (hash % n0) of segment
+ * ((hash >> 32) & (2^L - 1)), and buckets below the split pointer already
+ * use one more directory bit. Inserts split one bucket at a time whenever
+ * the load exceeds one full page per bucket, rehashing the keys of that
+ * bucket only. The directory doubles as needed, until the buckets no
+ * longer fit the split pointer.
+ *
+ * Entries start with their join key, 8 bytes wide by default. A table
+ * whose keys all lie near a base value, see set_key_base(), stores them
+ * as signed 32-bit offsets from it instead; get_key() and put_key()
+ * translate.
+ */
 class HashTable
 {
     public:
+        typedef unsigned short tag_t;
+        typedef unsigned long long hash_t;
+
+        /**
+         * Returns the fingerprint stored for an entry hashed to \a hash,
+         * bits 16 to 31. None of them picks the segment.
+         */
+        static inline tag_t make_tag(hash_t hash)
+        {
+            return (tag_t)(hash >> 16);
+        }
+
         void init(unsigned int nbuckets, unsigned int bucksize, unsigned int tuplesize);
         void destroy();
 
-        void* allocate(unsigned int offset);
+        /**
+         * Initializes this table as a copy of \a src. Geometry and page
+         * layout are kept, so every entry stays in its bucket and nothing
+         * is rehashed. The segments and their pages are shared with \a src
+         * until this table writes to them, see unshare(); \a src must not
+         * be written any more. A table attached to an image is copied
+         * right away.
+         */
+        void clone(HashTable* src);
+
+        /**
+         * Like clone(), but keeps only the entries whose key lies in
+         * [\a lo, \a hi]. Entries must start with their join key, see get_key().
+         * The copy gets as few segments as its entries need and pages only
+         * for the buckets that keep one.
+         */
+        void clone(HashTable* src, unsigned long long lo, unsigned long long hi);
+
+        /**
+         * Returns space for an entry hashed to \a hash. If the table is
+         * overloaded, one bucket is split first, so the returned slot stays
+         * put until the caller has filled it.
+         */
+        inline void* allocate(hash_t hash)
+        {
+            if (overloaded())
+                split();
+            ++ntuples_;
+            unsigned int hi = segment_of(hash, state_);
+            if (shared(hi))
+                unshare(hi);
+            return place(dir_[hi].heads_[bucket_of(hash)], make_tag(hash));
+        }
+
+        /** Copies the entry at \a src into the table. */
+        inline void insert(hash_t hash, const void* src)
+        {
+            memcpy(allocate(hash), src, tuplesize_);
+        }
+
+        /**
+         * Thread-safe insert(). Concurrent callers only serialize on the
+         * bucket they write, and the entry is copied under that lock, so a
+         * split never sees a half-written slot. A split is done by whoever
+         * gets the resize lock and is skipped by the others.
+         */
+        inline void atomic_insert(hash_t hash, const void* src)
+        {
+            if (overloaded() && resize_lock_.try_lock())
+            {
+                if (overloaded())
+                    atomic_split();
+                resize_lock_.unlock();
+            }
+
+            unsigned long long state;
+            Lock* l;
+            for (;;)
+            {
+                state = state_;
+                unsigned int hi = segment_of(hash, state);
+                if (shared(hi))
+                {
+                    resize_lock_.lock();
+                    if (shared(hi))
+                        unshare(hi);
+                    resize_lock_.unlock();
+                }
+                l = &lock_ref(hash, state);
+                l->lock();
+                if (state == state_ && !shared(hi))
+                    break;
+                // a split moved our bucket meanwhile
+                l->unlock();
+            }
+            memcpy(place(bucket_ref(hash, state), make_tag(hash)), src, tuplesize_);
+            l->unlock();
+            __sync_fetch_and_add(&ntuples_, 1);
+        }
 
         inline void set_start(unsigned long long start_value)
         {
@@ -52,74 +170,215 @@ class HashTable
             return end_value_;
         }
 
+        /**
+         * Stores keys as 32-bit offsets from \a base from now on. Call on
+         * an empty table, right after init().
+         */
+        inline void set_key_base(unsigned long long base)
+        {
+            key_base_ = base;
+            key_width_ = sizeof(int);
+        }
+
+        inline unsigned long long get_key_base()
+        {
+            return key_base_;
+        }
+
+        /**
+         * Hashes keys on their low \a width bytes from now on, the width of
+         * the join column they were read from. Call on an empty table.
+         */
+        inline void set_hash_width(unsigned int width)
+        {
+            hash_width_ = width;
+        }
+
+        inline unsigned int get_hash_width()
+        {
+            return hash_width_;
+        }
+
+        /** Hash of \a key, as the build computed it, see set_hash_width(). */
+        inline hash_t hash(unsigned long long key)
+        {
+            return hash_key(key, hash_width_);
+        }
+
+        /** Bytes of the key at the start of every entry, 8 or 4. */
+        inline unsigned int get_key_width()
+        {
+            return key_width_;
+        }
+
+        /** True if every key in [\a lo, \a hi] can be stored. */
+        inline bool fits(unsigned long long lo, unsigned long long hi)
+        {
+            return key_width_ == sizeof(unsigned long long)
+                || ((long long)(lo - key_base_) >= NARROW_MIN_ && (long long)(hi - key_base_) <= NARROW_MAX_);
+        }
+
+        /** Key of \a entry. */
+        inline unsigned long long get_key(const void* entry)
+        {
+            if (key_width_ == sizeof(unsigned long long))
+                return *(const unsigned long long*)entry;
+            return key_base_ + (long long)*(const int*)entry;
+        }
+
+        /** Writes \a key to the start of \a entry, see fits(). */
+        inline void put_key(void* entry, unsigned long long key)
+        {
+            if (key_width_ == sizeof(unsigned long long))
+                *(unsigned long long*)entry = key;
+            else
+                *(int*)entry = (int)(key - key_base_);
+        }
+
+        /** Current number of buckets, n0 * 2^level + split pointer. */
         inline unsigned int get_bucket_num()
         {
-            return nbuckets_;
+            unsigned long long state = state_;
+            return (n0_ << level_of(state)) + split_of(state);
+        }
+
+        inline unsigned long long get_tuple_num()
+        {
+            return ntuples_;
+        }
+
+        inline unsigned int get_tuple_size()
+        {
+            return tuplesize_;
         }
 
-        inline void* atomic_allocate(unsigned int offset)
+        /** Data bytes of a page, as passed to init(). */
+        inline unsigned int get_bucket_size()
         {
-            void* ret;
-            lock_[offset].lock();
-            ret = allocate(offset);
-            lock_[offset].unlock();
-            return ret;
+            return bucksize_;
         }
 
+        /**
+         * Counts the pages of all chains and the chains themselves, i.e. the
+         * buckets holding at least one page. Walks the whole table.
+         */
+        void get_chain_stats(unsigned long long& pages, unsigned long long& chains);
+
+        /** Bytes held by the pages and the bucket directory. Walks the whole table. */
+        unsigned long long get_size();
+
+        /** Bytes serialize() writes. */
+        unsigned long long get_image_size();
+
+        /**
+         * Writes the table to \a image in a position-independent layout:
+         *
+         *     [header][bucket heads of each segment][pages]
+         *
+         * Pages keep their in-memory layout, but bucket heads and next
+         * pointers hold offsets from \a image, 0 marking the end of a chain.
+         */
+        void serialize(char* image);
+
+        /**
+         * Initializes this table on an image written by serialize(), in
+         * place: offsets are turned back into pointers and the pages are
+         * used where they are. destroy() leaves the image alone. The table
+         * must not be written to afterwards. Returns false, leaving the
+         * table uninitialized and the image untouched, if the image does
+         * not fit in its \a len bytes or its header is inconsistent.
+         */
+        bool attach(char* image, unsigned long long len);
+
         class Iterator
         {
             friend class HashTable;
             public:
-                Iterator() : bucksize_(0), tuplesize_(0), cur_(0), next_(0), free_(0){ }
-                Iterator(unsigned int bucksize, unsigned int tuplesize);
+                Iterator() : page_(0), slot_(0), used_(0), tagsize_(0), bucksize_(0), tuplesize_(0) { }
+                Iterator(unsigned int tagsize, unsigned int bucksize, unsigned int tuplesize);
 
+                /**
+                 * Returns the next entry of the chain, or NULL at its end.
+                 */
                 inline void* read_next()
                 {
-                    void* ret;
-
-                    if(cur_ < free_)
+                    while (page_)
                     {
-                        ret = cur_;
-                        cur_ = ((char*)cur_) + tuplesize_;
-                        return ret;
+                        if (slot_ < used_)
+                        {
+                            return (char*)page_ + tagsize_ + (slot_++) * tuplesize_;
+                        }
+                        next_page();
                     }
-                    else if(next_ != 0)
-                    {
-                        ret = next_;
-                        cur_ = ((char*)next_)+tuplesize_;
-                        free_ = *(void**)((char*)next_ + bucksize_);
-                        next_ = *(void**)((char*)next_ + bucksize_ + sizeof(void*));
+                    return 0;
+                }
 
-                        return ret < free_ ? ret : 0;
-                    }
-                    else
+                /**
+                 * Returns the next entry of the chain whose fingerprint is
+                 * \a tag, or NULL at its end. Only the tag array of a page is
+                 * read for entries that do not match.
+                 */
+                inline void* read_next(tag_t tag)
+                {
+                    while (page_)
                     {
-                        return 0;
+                        const tag_t* tags = (const tag_t*)page_;
+                        while (slot_ < used_)
+                        {
+                            unsigned int s = slot_++;
+                            if (tags[s] == tag)
+                            {
+                                return (char*)page_ + tagsize_ + s * tuplesize_;
+                            }
+                        }
+                        next_page();
                     }
+                    return 0;
                 }
+
+                /**
+                 * Returns the fingerprint of the entry last returned by
+                 * read_next(), so it can be copied without rehashing.
+                 */
+                inline tag_t last_tag()
+                {
+                    return ((const tag_t*)page_)[slot_ - 1];
+                }
+
             private:
-                void* cur_;
-                void* free_;
-                void* next_;
+                inline void next_page()
+                {
+                    page_ = *(void**)((char*)page_ + tagsize_ + bucksize_ + sizeof(void*));
+                    used_ = page_ ? *(unsigned long*)((char*)page_ + tagsize_ + bucksize_) : 0;
+                    slot_ = 0;
+                }
+
+                void* page_;
+                unsigned int slot_;
+                unsigned int used_;
+                const unsigned int tagsize_;
                 const unsigned int bucksize_;
                 const unsigned int tuplesize_;
         };
 
         Iterator create_iterator();
 
-
+        /** Places \a it at the start of bucket number \a offset. */
         inline void place_iterator(Iterator& it, unsigned int offset)
         {
-            void* start = bucket_[offset];
-            it.cur_ = start;
-            it.free_ = *(void**)((char*)start + bucksize_);
-            it.next_ = *(void**)((char*)start + bucksize_ + sizeof(void*));
+            start_iterator(it, dir_[offset / n0_].heads_[offset % n0_]);
         }
 
-        inline void prefetch(unsigned int offset)
+        /** Places \a it at the start of the bucket that holds \a hash. */
+        inline void probe_iterator(Iterator& it, hash_t hash)
+        {
+            start_iterator(it, bucket_ref(hash, state_));
+        }
+
+        inline void prefetch(hash_t hash)
         {
 #ifdef __x86_64__
-            __asm__ __volatile__ ("prefetcht0 %0" :: "m" (*(unsigned long long*) bucket_[offset & (nbuckets_-1)]));
+            __asm__ __volatile__ ("prefetcht0 %0" :: "m" (*(unsigned long long*) bucket_ref(hash, state_)));
 #endif
         }
 
@@ -127,19 +386,206 @@ class HashTable
         {
             for(unsigned int i = 0; i < 10; i++)
             {
-                cout<<"Bucket["<<i<<"]: "<<reinterpret_cast<const char*>((reinterpret_cast<char*>(bucket_[i])+sizeof(unsigned long long)))<<flush<<endl;
+                cout<<"Bucket["<<i<<"]: "<<reinterpret_cast<const char*>((page_data(dir_[0].heads_[i])+sizeof(unsigned long long)))<<flush<<endl;
             }
         }
 
     private:
-        Lock* lock_;
-        void** bucket_;
+        /**
+         * Level and split pointer share one word, so that a reader always
+         * sees a consistent pair.
+         */
+        static inline unsigned int level_of(unsigned long long state)
+        {
+            return (unsigned int)(state >> 32);
+        }
+
+        static inline unsigned int split_of(unsigned long long state)
+        {
+            return (unsigned int)state;
+        }
+
+        /** Bucket of \a hash inside its segment. */
+        inline unsigned int bucket_of(hash_t hash)
+        {
+            return (unsigned int)hash % n0_;
+        }
+
+        /** Directory bits of \a hash, disjoint from its tag. */
+        static inline unsigned int dir_bits(hash_t hash)
+        {
+            return (unsigned int)(hash >> 32);
+        }
+
+        /** Segment holding \a hash, see bucket_of(). */
+        inline unsigned int segment_of(hash_t hash, unsigned long long state)
+        {
+            unsigned int level = level_of(state);
+            unsigned int hi = dir_bits(hash) & ((1u << level) - 1);
+            if (hi * n0_ + bucket_of(hash) < split_of(state))
+            {
+                // bucket already split, use one more directory bit
+                hi = dir_bits(hash) & ((2u << level) - 1);
+            }
+            return hi;
+        }
+
+        inline void*& bucket_ref(hash_t hash, unsigned long long state)
+        {
+            return dir_[segment_of(hash, state)].heads_[bucket_of(hash)];
+        }
+
+        inline Lock& lock_ref(hash_t hash, unsigned long long state)
+        {
+            return dir_[segment_of(hash, state)].locks_[bucket_of(hash)];
+        }
+
+        /** True if segment \a hi is still shared with other tables, see clone(). */
+        inline bool shared(unsigned int hi)
+        {
+            return *dir_[hi].refs_ > 1;
+        }
+
+        /**
+         * Gives this table a copy of segment \a hi and its pages, so that
+         * the tables it was shared with are never written. Writers of the
+         * segment wait for it under the resize lock.
+         */
+        void unshare(unsigned int hi);
+
+        /** Copies the chains of the \a heads of a segment. */
+        void** copy_heads(void** heads);
+
+        /** Drops a reference to the segment on \a heads, freeing it if last. */
+        void release_segment(void** heads, volatile unsigned int* refs);
+
+        /** True if the load calls for a split and one more level fits. */
+        inline bool overloaded()
+        {
+            return ntuples_ > (unsigned long long)slots_ * get_bucket_num()
+                && ((unsigned long long)n0_ << (level_of(state_) + 1)) <= MAX_BUCKETS_;
+        }
+
+        inline void start_iterator(Iterator& it, void* start)
+        {
+            it.page_ = start;
+            it.slot_ = 0;
+            it.used_ = start ? page_used(start) : 0;
+        }
+
+        /** Appends an entry to the chain starting at \a head. */
+        void* place(void*& head, tag_t tag);
+
+        void* new_page();
+
+        /** Splits the bucket under the split pointer. */
+        void split();
+
+        /** split() for tables that are written by several threads. */
+        void atomic_split();
+
+        /**
+         * Moves the entries of \a src whose rehashed key has directory bit
+         * \a bit set to \a dst.
+         */
+        void split_chain(void*& src, void*& dst, unsigned int bit);
+
+        /**
+         * Creates segment \a hi on \a heads, fresh empty heads if NULL,
+         * doubling the directory if it is too short. With \a refs the heads
+         * are shared with the tables counted there. A replaced directory
+         * is kept until destroy(), concurrent readers may still index it.
+         */
+        void add_segment(unsigned int hi, void** heads = 0, volatile unsigned int* refs = 0);
+
+        /** Points the directory at no segments, see add_segment(). */
+        void clear_directory();
+
+        /** Bytes of a whole page: tag array, data, used count and next pointer. */
+        inline unsigned int page_size()
+        {
+            return tagsize_ + bucksize_ + 2*sizeof(void*);
+        }
+
+        inline char* page_data(void* page)
+        {
+            return (char*)page + tagsize_;
+        }
+
+        inline unsigned long& page_used(void* page)
+        {
+            return *(unsigned long*)((char*)page + tagsize_ + bucksize_);
+        }
+
+        inline void*& page_next(void* page)
+        {
+            return *(void**)((char*)page + tagsize_ + bucksize_ + sizeof(void*));
+        }
+
+        static const unsigned long long MAX_BUCKETS_ = 0xffffffffULL;  ///< the split pointer is 32 bits
+        static const long long NARROW_MIN_ = -2147483647LL - 1;
+        static const long long NARROW_MAX_ = 2147483647LL;
+
+        /** A directory entry, n0 buckets. */
+        struct Segment
+        {
+            void** heads_;          ///< bucket heads, shared by clone()
+            Lock* locks_;           ///< this table's writers of each bucket
+            volatile unsigned int* refs_;   ///< tables sharing heads_ and their pages
+        };
+
+        /** Start of a serialized table, see serialize(). */
+        struct Image
+        {
+            unsigned int tuplesize_;
+            unsigned int bucksize_;
+            unsigned int tagsize_;
+            unsigned int slots_;
+            unsigned int n0_;
+            unsigned int key_width_;
+            unsigned int hash_width_;
+            unsigned int nsegs_;    ///< offsets of the segments' heads that follow, 0 if absent
+            unsigned long long state_;
+            unsigned long long ntuples_;
+            unsigned long long start_value_;
+            unsigned long long end_value_;
+            unsigned long long key_base_;
+        };
+
+        /** True if \a off can start a page of an image of \a len bytes. */
+        inline bool page_in_image(unsigned long long off, unsigned long long len)
+        {
+            return off >= sizeof(Image) && off % sizeof(void*) == 0
+                && off <= len && len - off >= page_size();
+        }
+
+        /** Checks an image for attach() without writing to it. */
+        bool check_image(const char* image, unsigned long long len);
+
+        /** Distance of two pages in an image, keeps them pointer-aligned. */
+        inline unsigned int page_stride()
+        {
+            return (page_size() + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        }
+
+        Segment* volatile dir_;   ///< segments by their directory bits
+        unsigned int dirsize_;    ///<directory slots, a power of two
+        vector<Segment*> old_dirs_;   ///<replaced directories, see add_segment()
+        Lock resize_lock_;
+        bool mapped_;             ///< pages and heads live in an image, see attach()
 
         unsigned int tuplesize_;
         unsigned int bucksize_;   ///<for data
-        unsigned int nbuckets_;
+        unsigned int tagsize_;    ///<tag array in front of the data, padded
+        unsigned int slots_;      ///<tuples per page
+        unsigned int n0_;         ///<buckets per segment
+        volatile unsigned long long state_;    ///<level << 32 | split pointer
+        unsigned long long ntuples_;
         unsigned long long start_value_;
         unsigned long long end_value_;
+        unsigned long long key_base_;
+        unsigned int key_width_;  ///<bytes of the key at the start of an entry
+        unsigned int hash_width_; ///<bytes of the key that are hashed, see hash()
 
 };
 
@@ -0,0 +1,123 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "speculator.h"
+#include "../common/rdtsc.h"
+#include <sched.h>
+#include <iostream>
+
+using namespace std;
+
+SpeculativeBuilder::SpeculativeBuilder(BaseAlgo* joiner, ReuseCache* cache, Table* build,
+        const string& name, unsigned int bucksize,
+        Schema* schema1, vector<unsigned int> select1, unsigned int jattr1,
+        Schema* schema2, vector<unsigned int> select2, unsigned int jattr2,
+        unsigned int selectivity)
+    : joiner_(joiner), cache_(cache), table_(build), name_(name), bucksize_(bucksize),
+      s1_(schema1), s2_(schema2), sel1_(select1), sel2_(select2),
+      ja1_(jattr1), ja2_(jattr2), selectivity_(selectivity),
+      pending_(false), stop_(false)
+{
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&cond_, NULL);
+}
+
+void SpeculativeBuilder::start()
+{
+    pthread_create(&thread_, NULL, run, this);
+}
+
+void SpeculativeBuilder::stop()
+{
+    pthread_mutex_lock(&mutex_);
+    stop_ = true;
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+    pthread_join(thread_, NULL);
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+void SpeculativeBuilder::request(const IntervalSet& pred, const BuildFilter& filter)
+{
+    pthread_mutex_lock(&mutex_);
+    pred_ = pred;
+    filter_ = filter;
+    pending_ = true;
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+void* SpeculativeBuilder::run(void* arg)
+{
+    SpeculativeBuilder* self = (SpeculativeBuilder*)arg;
+#ifdef SCHED_IDLE
+    // only use cycles the queries leave over
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+    pthread_mutex_lock(&self->mutex_);
+    while (true)
+    {
+        while (!self->pending_ && !self->stop_)
+            pthread_cond_wait(&self->cond_, &self->mutex_);
+        if (self->stop_)
+            break;
+        IntervalSet pred = self->pred_;
+        BuildFilter filter = self->filter_;
+        self->pending_ = false;
+        pthread_mutex_unlock(&self->mutex_);
+        self->build(pred, filter);
+        pthread_mutex_lock(&self->mutex_);
+    }
+    pthread_mutex_unlock(&self->mutex_);
+    return NULL;
+}
+
+void SpeculativeBuilder::build(const IntervalSet& pred, const BuildFilter& filter)
+{
+    joiner_->init(s1_, sel1_, ja1_, s2_, sel2_, ja2_, selectivity_, pred.lo(), pred.hi());
+    joiner_->set_predicate(pred);
+    joiner_->set_filter(filter);
+
+    // no query asked for these keys yet, so they count as neither
+    // accesses nor hits
+    cache_key key = joiner_->get_cache_key(name_);
+    ht_node* node = cache_->get_reusable_ht(key, pred, false);
+    if (node == NULL)
+    {
+        node = cache_->insert(joiner_->get_build_key(name_), pred, bucksize_,
+                joiner_->get_build_tuple_size(), joiner_->get_build_key_size(), false);
+    }
+    // already covered, or not worth a place in the cache
+    if (node->published_ || node->transient_)
+    {
+        cache_->release(node);
+        return;
+    }
+
+    cout << "Speculative build ["<<pred.lo()<<","<<pred.hi()<<"] in "<<pred.size()<<" intervals"<<flush<<endl;
+    unsigned long long cycles;
+    startTimer(&cycles);
+    TableScan scan(table_);
+    joiner_->build(&scan, node);
+    stopTimer(&cycles);
+    cache_->record_build(node, cycles);
+    cache_->publish(node);
+    cache_->release(node);
+}
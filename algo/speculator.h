@@ -0,0 +1,75 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPECULATOR_H
+#define SPECULATOR_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "algo.h"
+
+/**
+ * Background thread that builds predicted ranges into the cache while the
+ * current query is probing. It runs at idle priority with its own joiner
+ * and its own cursor over the build table, and only ever works on the
+ * latest request.
+ */
+class SpeculativeBuilder
+{
+    public:
+        SpeculativeBuilder(BaseAlgo* joiner, ReuseCache* cache, Table* build,
+                const std::string& name, unsigned int bucksize,
+                Schema* schema1, vector<unsigned int> select1, unsigned int jattr1,
+                Schema* schema2, vector<unsigned int> select2, unsigned int jattr2,
+                unsigned int selectivity);
+
+        void start();
+
+        /** Waits for the build in progress, if any, and ends the thread. */
+        void stop();
+
+        /**
+         * Asks for the keys \a pred of the rows that pass \a filter to be
+         * cached, replacing an older request.
+         */
+        void request(const IntervalSet& pred, const BuildFilter& filter);
+
+    private:
+        static void* run(void* arg);
+
+        void build(const IntervalSet& pred, const BuildFilter& filter);
+
+        BaseAlgo* joiner_;
+        ReuseCache* cache_;
+        Table* table_;
+        std::string name_;      ///< of the build table, see BaseAlgo::get_cache_key()
+        unsigned int bucksize_;
+        Schema* s1_, * s2_;
+        vector<unsigned int> sel1_, sel2_;
+        unsigned int ja1_, ja2_, selectivity_;
+
+        pthread_t thread_;
+        pthread_mutex_t mutex_;
+        pthread_cond_t cond_;
+        bool pending_;
+        bool stop_;
+        IntervalSet pred_;      ///< of the latest request
+        BuildFilter filter_;
+};
+
+#endif // SPECULATOR_H
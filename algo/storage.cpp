@@ -16,6 +16,7 @@
 */
 
 #include "algo.h"
+#include <algorithm>
 #ifdef VERBOSE
 #include <iostream>
 #include <iomanip>
@@ -27,25 +28,98 @@ void StoreCopy::init(Schema *schema1, vector<unsigned int> select1, unsigned int
 {
     //unsigned int nbucket = 512;
     HashBase::init(schema1,select1,jattr1,schema2,select2,jattr2,selectivity,cond_s,cond_e);
+    cols1_ = sel1_;
     //hashtable_.init(nbucket, size_, sbuild_->get_tuple_size());
 }
 
+void StoreCopy::set_filter(const BuildFilter& filter)
+{
+    HashBase::set_filter(filter);
+    cols1_ = sel1_;
+    delete sbuild_;
+    sbuild_ = new Schema();
+    sbuild_->add(sin1_->get(ja1_));
+    for (unsigned int i = 0; i < sel1_.size(); ++i)
+    {
+        sbuild_->add(sin1_->get(sel1_[i]));
+    }
+    for (unsigned int i = 0; i < filter.size(); ++i)
+    {
+        if (find(cols1_.begin(), cols1_.end(), filter.get_column(i)) == cols1_.end())
+        {
+            cols1_.push_back(filter.get_column(i));
+            sbuild_->add(sin1_->get(filter.get_column(i)));
+        }
+    }
+}
+
+cache_key StoreCopy::get_cache_key(const string& table)
+{
+    cache_key key(table, ja1_, cols1_);
+    key.filter_ = filter_;
+    return key;
+}
+
 
 void StoreCopy::destroy()
 {
+    delete snode_;
+    snode_ = NULL;
     HashBase::destroy();
     //hashtable_.destroy();
 }
 
+cache_key StorePointer::get_cache_key(const string& table)
+{
+    vector<unsigned int> all;
+    for (unsigned int i = 0; i < s1_->columns(); ++i)
+    {
+        all.push_back(i);
+    }
+    cache_key key(table, ja1_, all, cache_key::STORE_ROWIDS);
+    key.filter_ = filter_;
+    return key;
+}
+
 void StorePointer::destroy()
 {
     delete sbuild_;
+    delete snarrow_;
+    snarrow_ = NULL;
 
     //hashtable_.destroy();
 }
 
+void StoreCopy::bind(ht_node* node)
+{
+    delete snode_;
+    snode_ = NULL;
+    pos1_.clear();
+    const vector<unsigned int>& cols = node->key_.columns_;
+    bool narrow = node->hashtable_->get_key_width() != sizeof(unsigned long long);
+    if (cols == sel1_ && !narrow)
+    {
+        return;
+    }
+
+    snode_ = new Schema();
+    if (narrow)
+        snode_->add(CT_INTEGER);
+    else
+        snode_->add(sin1_->get(ja1_));
+    for (unsigned int i = 0; i < cols.size(); ++i)
+    {
+        snode_->add(sin1_->get(cols[i]));
+    }
+    for (unsigned int j = 0; j < sel1_.size() && cols != sel1_; ++j)
+    {
+        pos1_.push_back(find(cols.begin(), cols.end(), sel1_[j]) - cols.begin() + 1);
+    }
+}
+
 void StoreCopy::buildCursor(PageCursor *t, ht_node *node, bool atomic)
 {
+    bind(node);
     if(atomic)
         realbuildCursor<true>(t,node);
     else
@@ -60,71 +134,107 @@ void StoreCopy::realbuildCursor(PageCursor* t, ht_node *node)
     void* tup;
     Page* b;
     Schema*s  = t->schema();
-    unsigned int curbuc;
-    unsigned int buckpos;
-    unsigned int nbuckets = node->hashtable_->get_bucket_num();
+    HashTable::hash_t curbuc;
+    // a wider reused node keeps its own columns
+    Schema* sentry = snode_ ? snode_ : sbuild_;
+    const vector<unsigned int>& cols = node->key_.columns_;
+    char entry[sentry->get_tuple_size()];
     if(node->init_)
     {
         cout << "It is new node"<<flush<<endl;
     }
-    while (b = (atomic ? t->atomic_read_next() : t->read_next()))
+    // a new table hashes keys at the width of our join column
+    if(node->hashtable_->get_tuple_num() == 0)
+    {
+        node->hashtable_->set_hash_width(s->get_column_type_size(ja1_));
+    }
+    // only the intervals the node does not hold yet
+    IntervalSet todo = pred_.minus(node->ranges_);
+    // a draft keeps the filter of the node it extends
+    const BuildFilter& bfilter = node->key_.filter_;
+    vector<unsigned int> bpos = bfilter.columns();
+    while ((b = (atomic ? t->atomic_read_next() : t->read_next())))
     {
         i = 0;
-        while(tup = b->get_tuple_offset(i++))
+        while((tup = b->get_tuple_offset(i++)))
         {
             // find hash table to append
             unsigned long long value1 = s->as_long(tup,ja1_);
-            if(value1 < cond_s_ || value1 > cond_e_)
+            if(!todo.contains(value1) || !bfilter.passes(s, tup, bpos))
             {
                 continue;
             }
-            if(value1 >= node->start_value_ && value1 <= node->end_value_ && !(node->init_))
-            {
-                //cout<<"should be here"<<endl;
-                continue;
-            }
             //cout<< "value1 is " << value1 <<endl;
-            curbuc = murmurhash2(&value1,s->get_column_type_size(ja1_),0);
-            buckpos = curbuc % nbuckets;
-            //cout<< "cal value1 is " << curbuc << "buckpos is " << buckpos <<"\t" <<"curbuc is "<< curbuc<<endl;
-            void* target = atomic ? node->hashtable_->atomic_allocate(buckpos) :
-                                    node->hashtable_->allocate(buckpos);
+            curbuc = node->hashtable_->hash(value1);
+            //cout<< "cal value1 is " << curbuc <<endl;
 
 #ifdef VERBOSE
         cout << "Adding tuple with key "
             << setfill('0') << setw(7) << s->as_long(tup, ja1_)
             << " to bucket " << setfill('0') << setw(4) << curbuc << endl;
 #endif
-            sbuild_->write_data(target, 0, s->calc_offset(tup, ja1_));
-            for(unsigned int j=0; j<sel1_.size(); ++j)
+            node->hashtable_->put_key(entry, value1);
+            for(unsigned int j=0; j<cols.size(); ++j)
             {
-                sbuild_->write_data(target,                 // dest
+                sentry->write_data(entry,                   // dest
                          j+1,                               // col in output
-                         s->calc_offset(tup,sel1_[j]));     // src for this col
+                         s->calc_offset(tup,cols[j]));      // src for this col
+            }
+            if (atomic)
+            {
+                node->hashtable_->atomic_insert(curbuc, entry);
+                node->bloom_->atomic_add(curbuc);
+            }
+            else
+            {
+                node->hashtable_->insert(curbuc, entry);
+                node->bloom_->add(curbuc);
             }
         }
     }
-    node->start_value_ = cond_s_ < node->start_value_ ? cond_s_ : node->start_value_;
-    node->end_value_ = cond_e_ > node->end_value_ ? cond_e_ : node->end_value_;
-    node->init_ = false;
+    // a published node covers the query already and must stay untouched
+    if(!node->published_)
+    {
+        node->set_ranges(node->ranges_.unite(pred_));
+        node->init_ = false;
+    }
     //node->hashtable_->print();
     cout << "cond_s:"<<cond_s_<<" cond_e:"<<cond_e_<<endl;
     cout << "start:"<<node->start_value_<<" end:"<<node->end_value_<<endl;
+    cout << "buckets:"<<node->hashtable_->get_bucket_num()<<" tuples:"<<node->hashtable_->get_tuple_num()<<endl;
+    cout << "bloom filter keys:"<<node->bloom_->get_key_num()<<" fpr:"<<node->bloom_->false_positive_rate()<<endl;
     cout << "Finishing build hashtable!, cache hashtable:["<<node->start_value_<<","<<node->end_value_<<"]" << endl;
 }
 
 WriteTable* StoreCopy::probeCursor(PageCursor *t, ht_node *node, bool atomic, WriteTable *ret)
 {
-    if (atomic)
-        return realprobeCursor<true>(t,node, ret);
-    return realprobeCursor<false>(t,node, ret);
+    bind(node);
+    switch (output_)
+    {
+        case output_mode::DISCARD:
+            return atomic ? realprobeCursor<true, DiscardSink>(t, node, ret)
+                : realprobeCursor<false, DiscardSink>(t, node, ret);
+        case output_mode::WRITE:
+            return atomic ? realprobeCursor<true, WriteSink>(t, node, ret)
+                : realprobeCursor<false, WriteSink>(t, node, ret);
+        case output_mode::WRITE_NT:
+            return atomic ? realprobeCursor<true, WriteNTSink>(t, node, ret)
+                : realprobeCursor<false, WriteNTSink>(t, node, ret);
+        case output_mode::AGGREGATE:
+            return atomic ? realprobeCursor<true, AggregateSink>(t, node, ret)
+                : realprobeCursor<false, AggregateSink>(t, node, ret);
+        default:
+            return atomic ? realprobeCursor<true, AssembleSink>(t, node, ret)
+                : realprobeCursor<false, AssembleSink>(t, node, ret);
+    }
 }
 
 
-template<bool atomic>
+template<bool atomic, typename Sink>
 WriteTable* StoreCopy::realprobeCursor(PageCursor* t, ht_node *node, WriteTable* ret)
 {
-    if(ret == NULL)
+    // aggregates are read off the entries, no output table is needed
+    if(ret == NULL && !Sink::AGGREGATES)
     {
         ret = new WriteTable();
         ret->init(sout_,outputsize_);
@@ -135,18 +245,35 @@ WriteTable* StoreCopy::realprobeCursor(PageCursor* t, ht_node *node, WriteTable*
     void* tup2;
 
     Page* b2;
-    unsigned int curbuc, i, buckpos;
-    unsigned nbuckets = node->hashtable_->get_bucket_num();
+    HashTable::hash_t curbuc;
+    unsigned int i;
+    HashTable::tag_t tag;
 
     HashTable::Iterator it = node->hashtable_->create_iterator();
+    Schema* sentry = snode_ ? snode_ : sbuild_;
+    bool narrow = node->hashtable_->get_key_width() != sizeof(unsigned long long);
+    unsigned long long base = node->hashtable_->get_key_base();
+    // what the filter of the node leaves of ours, checked on the entries
+    BuildFilter residual = filter_.residual(node->key_.filter_);
+    bool filtered = !residual.empty();
+    const vector<unsigned int>& cols = node->key_.columns_;
+    vector<unsigned int> rpos;
+    for (unsigned int j = 0; j < residual.size(); ++j)
+    {
+        rpos.push_back(find(cols.begin(), cols.end(), residual.get_column(j)) - cols.begin() + 1);
+    }
+    agg_value total;
+    unsigned long long matches = 0, probed = 0;
+    bool wide = aggregating_ && CT_LONG == sout_->get_column_type(agg_.column_);
+    bool gwide = aggregating_ && agg_.grouped() && CT_LONG == sout_->get_column_type(agg_.group_);
 
-    while(b2 = (atomic ? t->atomic_read_next() : t->read_next()))
+    while((b2 = (atomic ? t->atomic_read_next() : t->read_next())))
     {
 #ifdef VERBOSE
         cout << "Working on page " << b2 << endl;
 #endif
         i = 0;
-        while(tup2 = b2->get_tuple_offset(i++))
+        while((tup2 = b2->get_tuple_offset(i++)))
         {
 #ifdef VERBOSE
             cout << "Joining tuple " << b2 << ":"
@@ -154,17 +281,24 @@ WriteTable* StoreCopy::realprobeCursor(PageCursor* t, ht_node *node, WriteTable*
                 << " having key " << s2->as_long(tup2, ja2_) << endl;
 #endif
             unsigned long long value = s2_->as_long(tup2,ja2_);
-            if(value < cond_s_ || value > cond_e_)
+            if(!pred_.contains(value))
             {
                 continue;
             }
-            curbuc = murmurhash2(&value, s2_->get_column_type_size(ja2_),0);
+            ++probed;
+            curbuc = node->hashtable_->hash(value);
 #ifdef VERBOSE
             cout << "\twith bucket " << setfill('0') << setw(6) << curbuc << endl;
 #endif
-            buckpos = curbuc % nbuckets;
-            //cout<< "Joined value is " << value <<"\t" << "cur is "<< curbuc << "\t" <<"buckpos is "<<buckpos<<"\t"<<"size is "<<sizeof(s2_->get_column_type_size(ja2_))<<endl;
-            node->hashtable_->place_iterator(it,buckpos);
+            if(!node->bloom_->contains(curbuc))
+            {
+                continue;
+            }
+            tag = HashTable::make_tag(curbuc);
+            // the query range lies in the node's, so the offset fits
+            int delta = (int)(value - base);
+            //cout<< "Joined value is " << value <<"\t" << "cur is "<< curbuc <<"\t"<<"size is "<<sizeof(s2_->get_column_type_size(ja2_))<<endl;
+            node->hashtable_->probe_iterator(it,curbuc);
 
 #ifdef PREFETCH
 #warning Only works for 16-byte tuples!
@@ -175,36 +309,68 @@ WriteTable* StoreCopy::realprobeCursor(PageCursor* t, ht_node *node, WriteTable*
 //            {
 //                cout <<"Empty!" << flush<<endl;
 //            }
-            while(tup1 = it.read_next())
+            // only entries with a matching fingerprint are loaded
+            while((tup1 = it.read_next(tag)))
             {
-                if(sbuild_->as_long(tup1,0) != value)
+                if(narrow ? *(int*)tup1 != delta : *(unsigned long long*)tup1 != value)
                 {
                     continue;
                 }
-                //cout<< "Joined value is " << value <<"\t" << "cur is "<< curbuc << "\t" <<"buckpos is "<<buckpos<<endl;
-#if defined(OUTPUT_ASSEMBLE)
-                // copy payload of first tuple to destination
-                if (s1_->get_tuple_size())
-                    s1_->copy_tuple(tmp, sbuild_->calc_offset(tup1,1));
-
-                // copy each column to destination
-                for (unsigned int j=0; j<sel2_.size(); ++j)
-                    sout_->write_data(tmp,		// dest
-                            s1_->columns()+j,	// col in output
-                            s2_->calc_offset(tup2, sel2_[j]));	// src for this col
-#if defined(OUTPUT_WRITE_NORMAL)
-                ret->append(tmp);
-#elif defined(OUTPUT_WRITE_NT)
-                ret->non_temporal_append16(tmp);
-#endif
-#endif
-
-#if !defined(OUTPUT_AGGREGATE) && !defined(OUTPUT_ASSEMBLE)
-                __asm__ __volatile__ ("nop");
-#endif
+                if(filtered && !residual.passes(sentry, tup1, rpos))
+                {
+                    continue;
+                }
+                ++matches;
+                //cout<< "Joined value is " << value <<"\t" << "cur is "<< curbuc <<endl;
+                if (Sink::AGGREGATES)
+                {
+                    // the values are read where they lie, nothing is assembled
+                    if (aggregating_)
+                    {
+                        void* src = column_of(sentry, tup1, tup2, agg_.column_);
+                        long long v = wide ? *(long long*)src : *(int*)src;
+                        long long g = 0;
+                        if (agg_.grouped())
+                        {
+                            src = column_of(sentry, tup1, tup2, agg_.group_);
+                            g = gwide ? *(long long*)src : *(int*)src;
+                        }
+                        aggregate(value, v, g, total);
+                    }
+                }
+                else if (Sink::ASSEMBLES)
+                {
+                    // copy payload of first tuple to destination
+                    if (!pos1_.empty())
+                    {
+                        for (unsigned int j=0; j<sel1_.size(); ++j)
+                            sout_->write_data(tmp, j, snode_->calc_offset(tup1, pos1_[j]));
+                    }
+                    else if (s1_->get_tuple_size())
+                        s1_->copy_tuple(tmp, sentry->calc_offset(tup1,1));
+
+                    // copy each column to destination
+                    for (unsigned int j=0; j<sel2_.size(); ++j)
+                        sout_->write_data(tmp,		// dest
+                                s1_->columns()+j,	// col in output
+                                s2_->calc_offset(tup2, sel2_[j]));	// src for this col
+                    Sink::write(ret, tmp);
+                    if (Sink::WRITES && record_)
+                        record_->add(value, tmp);
+                    if (aggregating_)
+                        aggregate(value, output_value(tmp, agg_.column_),
+                                agg_.grouped() ? output_value(tmp, agg_.group_) : 0, total);
+                }
+                else
+                {
+                    __asm__ __volatile__ ("nop");
+                }
             }
         }
     }
+    agg_total_.merge(total);
+    matches_ += matches;
+    probed_ += probed;
     return ret;
 }
 
@@ -218,15 +384,24 @@ void StorePointer::init(Schema *schema1, vector<unsigned int> select1, unsigned
     s1_ = schema1;
     delete sbuild_;
 
-    // generate build schema
+    // generate build schema: the key and a row id, see PageDirectory
     sbuild_ = new Schema();
     sbuild_->add(schema1->get(ja1_));
-    sbuild_->add(CT_POINTER);
+    sbuild_->add(CT_INTEGER);
+    delete snarrow_;
+    snarrow_ = new Schema();
+    snarrow_->add(CT_INTEGER);
+    snarrow_->add(CT_INTEGER);
 
     // create hashtable with new build schema
     //hashtable_.init(512, size_, sbuild_->get_tuple_size());
 }
 
+void StorePointer::set_build_table(Table* t)
+{
+    dir_.init(t);
+}
+
 
 void StorePointer::buildCursor(PageCursor *t, ht_node* node ,bool atomic)
 {
@@ -243,43 +418,88 @@ void StorePointer::realbuildCursor(PageCursor* t, ht_node* node)
     void* tup;
     Page* b;
     Schema* s = t->schema();
-    unsigned int curbuc;
-    while(b = (atomic ? t->atomic_read_next() : t->read_next()))
+    HashTable::hash_t curbuc;
+    Schema* sentry = node->hashtable_->get_key_width() != sizeof(unsigned long long) ? snarrow_ : sbuild_;
+    char entry[sentry->get_tuple_size()];
+    // a new table hashes keys at the width of our join column
+    if(node->hashtable_->get_tuple_num() == 0)
     {
+        node->hashtable_->set_hash_width(s->get_column_type_size(ja1_));
+    }
+    // only the intervals the node does not hold yet
+    IntervalSet todo = pred_.minus(node->ranges_);
+    // a draft keeps the filter of the node it extends
+    const BuildFilter& bfilter = node->key_.filter_;
+    vector<unsigned int> bpos = bfilter.columns();
+    while((b = (atomic ? t->atomic_read_next() : t->read_next())))
+    {
+        unsigned int row = dir_.first_row(b);
         i = 0;
-        while(tup = b->get_tuple_offset(i++)) {
+        for (; (tup = b->get_tuple_offset(i)); ++i) {
+            unsigned long long value1 = s->as_long(tup,ja1_);
+            if(!todo.contains(value1) || !bfilter.passes(s, tup, bpos))
+            {
+                continue;
+            }
             // find hash table to append
-            curbuc = murmurhash2(s->as_pointer(tup,ja1_),s->get_column_type_size(ja1_),0);
-            void* target = atomic ?
-                node->hashtable_->atomic_allocate(curbuc) :
-                node->hashtable_->allocate(curbuc);
+            curbuc = node->hashtable_->hash(value1);
 
 #ifdef VERBOSE
         cout << "Adding tuple with key "
-            << setfill('0') << setw(7) << s->asLong(tup, ja1)
+            << setfill('0') << setw(7) << s->as_long(tup, ja1_)
             << " to bucket " << setfill('0') << setw(4) << curbuc << endl;
 #endif
 
-            sbuild_->write_data(target, 0, s->calc_offset(tup, ja1_));
-            sbuild_->write_data(target, 1, &tup);
+            unsigned int rowid = row + i;
+            node->hashtable_->put_key(entry, value1);
+            sentry->write_data(entry, 1, &rowid);
+            if (atomic) {
+                node->hashtable_->atomic_insert(curbuc, entry);
+                node->bloom_->atomic_add(curbuc);
+            } else {
+                node->hashtable_->insert(curbuc, entry);
+                node->bloom_->add(curbuc);
+            }
 
         }
     }
+    // a published node covers the query already and must stay untouched
+    if(!node->published_)
+    {
+        node->set_ranges(node->ranges_.unite(pred_));
+        node->init_ = false;
+    }
+    cout << "Finishing build hashtable!, cache hashtable:["<<node->start_value_<<","<<node->end_value_<<"]" << endl;
 }
 
 
 
 WriteTable* StorePointer::probeCursor(PageCursor *t, ht_node *node, bool atomic, WriteTable *ret)
 {
-    if (atomic)
-        return realprobeCursor<true>(t, node, ret);
-    return realprobeCursor<false>(t, node, ret);
+    switch (output_) {
+        case output_mode::DISCARD:
+            return atomic ? realprobeCursor<true, DiscardSink>(t, node, ret)
+                : realprobeCursor<false, DiscardSink>(t, node, ret);
+        case output_mode::WRITE:
+            return atomic ? realprobeCursor<true, WriteSink>(t, node, ret)
+                : realprobeCursor<false, WriteSink>(t, node, ret);
+        case output_mode::WRITE_NT:
+            return atomic ? realprobeCursor<true, WriteNTSink>(t, node, ret)
+                : realprobeCursor<false, WriteNTSink>(t, node, ret);
+        case output_mode::AGGREGATE:
+            return atomic ? realprobeCursor<true, AggregateSink>(t, node, ret)
+                : realprobeCursor<false, AggregateSink>(t, node, ret);
+        default:
+            return atomic ? realprobeCursor<true, AssembleSink>(t, node, ret)
+                : realprobeCursor<false, AssembleSink>(t, node, ret);
+    }
 }
 
-template <bool atomic>
+template <bool atomic, typename Sink>
 WriteTable* StorePointer::realprobeCursor(PageCursor* t, ht_node *node , WriteTable* ret)
 {
-    if (ret == NULL) {
+    // aggregates are read off the entries, no output table is needed
+    if (ret == NULL && !Sink::AGGREGATES) {
         ret = new WriteTable();
         ret->init(sout_, outputsize_);
     }
@@ -288,15 +508,36 @@ WriteTable* StorePointer::realprobeCursor(PageCursor* t, ht_node *node , WriteTa
     void* tup1;
     void* tup2;
     Page* b2;
-    unsigned int curbuc, i;
+    HashTable::hash_t curbuc;
+    unsigned int i;
 
     HashTable::Iterator it = node->hashtable_->create_iterator();
-
-    while (b2 = (atomic ? t->atomic_read_next() : t->read_next())) {
+    bool narrow = node->hashtable_->get_key_width() != sizeof(unsigned long long);
+    Schema* sentry = narrow ? snarrow_ : sbuild_;
+    unsigned long long base = node->hashtable_->get_key_base();
+    // what the filter of the node leaves of ours, checked on the rows
+    BuildFilter residual = filter_.residual(node->key_.filter_);
+    bool filtered = !residual.empty();
+    vector<unsigned int> rpos = residual.columns();
+    agg_value total;
+    unsigned long long matches = 0, probed = 0;
+    bool wide = aggregating_ && CT_LONG == sout_->get_column_type(agg_.column_);
+    bool gwide = aggregating_ && agg_.grouped() && CT_LONG == sout_->get_column_type(agg_.group_);
+
+    while ((b2 = (atomic ? t->atomic_read_next() : t->read_next()))) {
         i = 0;
-        while (tup2 = b2->get_tuple_offset(i++)) {
-            curbuc = murmurhash2(s2_->as_pointer(tup2,ja2_), sizeof(s2_->get_column_type_size(ja2_)),0);
-            node->hashtable_->place_iterator(it, curbuc);
+        while ((tup2 = b2->get_tuple_offset(i++))) {
+            unsigned long long value = s2_->as_long(tup2,ja2_);
+            if (!pred_.contains(value)) {
+                continue;
+            }
+            ++probed;
+            curbuc = node->hashtable_->hash(value);
+            if (!node->bloom_->contains(curbuc)) {
+                continue;
+            }
+            node->hashtable_->probe_iterator(it, curbuc);
+            int delta = (int)(value - base);
 
 #ifdef PREFETCH
 #warning Only works for 16-byte tuples!
@@ -304,72 +545,52 @@ WriteTable* StorePointer::realprobeCursor(PageCursor* t, ht_node *node , WriteTa
             node->hashtable_->prefetch(murmurhash2(s2_->as_pointer(reinterpret_cast<void*>((char*)tup2+32),ja2_), sizeof(s2_,ja2_),0));
 #endif
 
-            while (tup1 = it.read_next()) {
-                if (sbuild_->as_long(tup1,0) != s2_->as_long(tup2,ja2_) ) {
+            while ((tup1 = it.read_next(HashTable::make_tag(curbuc)))) {
+                if (narrow ? *(int*)tup1 != delta : *(unsigned long long*)tup1 != value) {
                     continue;
                 }
-
-#if defined(OUTPUT_ASSEMBLE)
-                void* realtup1 = sbuild_->as_pointer(tup1, 1);
-                // copy each column to destination
-                for (unsigned int j=0; j<sel1_.size(); ++j)
-                    sout_->write_data(tmp,		// dest
-                            j,		// col in output
-                            s1_->calc_offset(realtup1, sel1_[j]));	// src for this col
-                for (unsigned int j=0; j<sel2_.size(); ++j)
-                    sout_->write_data(tmp,		// dest
-                            sel1_.size()+j,	// col in output
-                            s2_->calc_offset(tup2, sel2_[j]));	// src for this col
-#if defined(OUTPUT_WRITE_NORMAL)
-                ret->append(tmp);
-#elif defined(OUTPUT_WRITE_NT)
-                ret->non_temporal_append16(tmp);
-#endif
-#endif
-
-
-#if !defined(OUTPUT_AGGREGATE) && !defined(OUTPUT_ASSEMBLE)
-                __asm__ __volatile__ ("nop");
-#endif
-
+                if (filtered && !residual.passes(s1_, dir_.get_tuple(sentry->as_int(tup1, 1)), rpos)) {
+                    continue;
+                }
+                ++matches;
+
+                if (Sink::AGGREGATES) {
+                    // the values are read where they lie, nothing is assembled
+                    if (aggregating_) {
+                        void* src = column_of(sentry, tup1, tup2, agg_.column_);
+                        long long v = wide ? *(long long*)src : *(int*)src;
+                        long long g = 0;
+                        if (agg_.grouped()) {
+                            src = column_of(sentry, tup1, tup2, agg_.group_);
+                            g = gwide ? *(long long*)src : *(int*)src;
+                        }
+                        aggregate(value, v, g, total);
+                    }
+                } else if (Sink::ASSEMBLES) {
+                    void* realtup1 = dir_.get_tuple(sentry->as_int(tup1, 1));
+                    // copy each column to destination
+                    for (unsigned int j=0; j<sel1_.size(); ++j)
+                        sout_->write_data(tmp,		// dest
+                                j,		// col in output
+                                s1_->calc_offset(realtup1, sel1_[j]));	// src for this col
+                    for (unsigned int j=0; j<sel2_.size(); ++j)
+                        sout_->write_data(tmp,		// dest
+                                sel1_.size()+j,	// col in output
+                                s2_->calc_offset(tup2, sel2_[j]));	// src for this col
+                    Sink::write(ret, tmp);
+                    if (Sink::WRITES && record_)
+                        record_->add(value, tmp);
+                    if (aggregating_)
+                        aggregate(value, output_value(tmp, agg_.column_),
+                                agg_.grouped() ? output_value(tmp, agg_.group_) : 0, total);
+                } else {
+                    __asm__ __volatile__ ("nop");
+                }
             }
         }
     }
+    agg_total_.merge(total);
+    matches_ += matches;
+    probed_ += probed;
     return ret;
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -0,0 +1,167 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "aggregates.h"
+
+void agg_value::merge(const agg_value& other)
+{
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = other.min_ < min_ ? other.min_ : min_;
+    max_ = other.max_ > max_ ? other.max_ : max_;
+}
+
+long long agg_value::get(unsigned int func) const
+{
+    switch (func)
+    {
+        case agg_spec::SUM:
+            return sum_;
+        case agg_spec::MIN:
+            return min_;
+        case agg_spec::MAX:
+            return max_;
+        default:
+            return count_;
+    }
+}
+
+void GroupTable::merge(const GroupTable& other)
+{
+    for (unsigned long long i = 0; i < other.slots_.size(); ++i)
+    {
+        if (other.slots_[i].used_)
+        {
+            lookup(other.slots_[i].group_).merge(other.slots_[i].value_);
+        }
+    }
+}
+
+void GroupTable::clear()
+{
+    slots_.clear();
+    used_ = 0;
+    mask_ = 0;
+}
+
+agg_value GroupTable::total() const
+{
+    agg_value ret;
+    for (unsigned long long i = 0; i < slots_.size(); ++i)
+    {
+        if (slots_[i].used_)
+        {
+            ret.merge(slots_[i].value_);
+        }
+    }
+    return ret;
+}
+
+void GroupTable::grow()
+{
+    vector<slot> old;
+    old.swap(slots_);
+    slots_.resize(old.empty() ? 1024 : 2 * old.size());
+    mask_ = slots_.size() - 1;
+    used_ = 0;
+    for (unsigned long long i = 0; i < old.size(); ++i)
+    {
+        if (old[i].used_)
+        {
+            lookup(old[i].group_).merge(old[i].value_);
+        }
+    }
+}
+
+agg_node::agg_node(const result_key& key, unsigned int column, const IntervalSet& keys,
+        unsigned long long width)
+    : key_(key), column_(column), keys_(keys), width_(width), first_(keys.lo() / width),
+      parts_(keys.hi() / width - keys.lo() / width + 1)
+{
+}
+
+ChunkAggregates::~ChunkAggregates()
+{
+    for (unsigned int i = 0; i < entries_.size(); ++i)
+    {
+        delete entries_[i];
+    }
+}
+
+ChunkAggregates::entry* ChunkAggregates::find(const result_key& key, unsigned int column)
+{
+    for (unsigned int i = 0; i < entries_.size(); ++i)
+    {
+        if (entries_[i]->key_ == key && entries_[i]->column_ == column)
+        {
+            return entries_[i];
+        }
+    }
+    return NULL;
+}
+
+IntervalSet ChunkAggregates::combine(const result_key& key, unsigned int column,
+        const IntervalSet& keys, agg_value& total)
+{
+    entry* e = find(key, column);
+    if (NULL == e)
+    {
+        return keys;
+    }
+    IntervalSet known;
+    for (unsigned int i = 0; i < keys.size(); ++i)
+    {
+        // the chunks inside [lo, hi]
+        unsigned long long first = (keys.get_lo(i) + width_ - 1) / width_;
+        unsigned long long end = (keys.get_hi(i) + 1) / width_;
+        map<unsigned long long, agg_value>::const_iterator it = e->chunks_.lower_bound(first);
+        for (; it != e->chunks_.end() && it->first < end; ++it)
+        {
+            total.merge(it->second);
+            known.add(it->first * width_, (it->first + 1) * width_ - 1);
+        }
+    }
+    return keys.minus(known);
+}
+
+agg_node* ChunkAggregates::record(const result_key& key, unsigned int column,
+        const IntervalSet& keys)
+{
+    return new agg_node(key, column, keys, width_);
+}
+
+void ChunkAggregates::publish(agg_node* node, agg_value& total)
+{
+    entry* e = find(node->key_, node->column_);
+    if (NULL == e)
+    {
+        e = new entry;
+        e->key_ = node->key_;
+        e->column_ = node->column_;
+        entries_.push_back(e);
+    }
+    for (unsigned int i = 0; i < node->parts_.size(); ++i)
+    {
+        unsigned long long chunk = node->first_ + i;
+        total.merge(node->parts_[i]);
+        if (node->keys_.contains(IntervalSet(chunk * width_, (chunk + 1) * width_ - 1)))
+        {
+            e->chunks_[chunk] = node->parts_[i];
+        }
+    }
+    delete node;
+}
@@ -0,0 +1,211 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AGGREGATES_H
+#define AGGREGATES_H
+
+#include "results.h"
+#include "intervals.h"
+#include <climits>
+#include <map>
+#include <vector>
+
+using std::map;
+using std::vector;
+
+/** What an aggregate query asks of the join output. */
+struct agg_spec
+{
+    enum
+    {
+        COUNT,
+        SUM,
+        MIN,
+        MAX
+    };
+
+    static const unsigned int NO_GROUP = ~0U;
+
+    agg_spec() : func_(COUNT), column_(0), group_(NO_GROUP) { }
+
+    bool grouped() const { return NO_GROUP != group_; }
+
+    unsigned int func_;
+    unsigned int column_;   ///< output column aggregated, integer
+    unsigned int group_;    ///< output column grouped on, integer, or NO_GROUP
+};
+
+/** COUNT, SUM, MIN and MAX of the values of one column. */
+struct agg_value
+{
+    agg_value() : count_(0), sum_(0), min_(LLONG_MAX), max_(LLONG_MIN) { }
+
+    inline void add(long long v)
+    {
+        ++count_;
+        sum_ += v;
+        min_ = v < min_ ? v : min_;
+        max_ = v > max_ ? v : max_;
+    }
+
+    void merge(const agg_value& other);
+
+    /** The result of \a func, see agg_spec. */
+    long long get(unsigned int func) const;
+
+    unsigned long long count_;
+    long long sum_;
+    long long min_;
+    long long max_;
+};
+
+/**
+ * Aggregates by group value, open addressing with linear probing. Grows
+ * at half load.
+ */
+class GroupTable
+{
+    public:
+        GroupTable() : used_(0), mask_(0) { }
+
+        inline void add(long long group, long long v)
+        {
+            lookup(group).add(v);
+        }
+
+        void merge(const GroupTable& other);
+
+        void clear();
+
+        /** Number of groups. */
+        unsigned long long size() const { return used_; }
+
+        /** Aggregates of all groups together. */
+        agg_value total() const;
+
+    private:
+        struct slot
+        {
+            slot() : used_(false), group_(0) { }
+            bool used_;
+            long long group_;
+            agg_value value_;
+        };
+
+        static inline unsigned long long hash(long long group)
+        {
+            return (unsigned long long)group * 0x9E3779B97F4A7C15ULL >> 17;
+        }
+
+        /** The aggregates of \a group, added if missing. */
+        inline agg_value& lookup(long long group)
+        {
+            if (2 * (used_ + 1) > slots_.size())
+            {
+                grow();
+            }
+            unsigned long long i = hash(group) & mask_;
+            while (slots_[i].used_ && slots_[i].group_ != group)
+            {
+                i = (i + 1) & mask_;
+            }
+            if (!slots_[i].used_)
+            {
+                slots_[i].used_ = true;
+                slots_[i].group_ = group;
+                ++used_;
+            }
+            return slots_[i].value_;
+        }
+
+        void grow();
+
+        vector<slot> slots_;
+        unsigned long long used_;
+        unsigned long long mask_;
+};
+
+/**
+ * Aggregates of one column of the output of one query, per chunk of
+ * width_ keys, see ChunkAggregates::record().
+ */
+struct agg_node
+{
+    agg_node(const result_key& key, unsigned int column, const IntervalSet& keys,
+            unsigned long long width);
+
+    /** Adds the value \a v of an output tuple joined on \a key, see BaseAlgo::set_aggregator(). */
+    inline void add(unsigned long long key, long long v)
+    {
+        parts_[key / width_ - first_].add(v);
+    }
+
+    result_key key_;
+    unsigned int column_;       ///< output column aggregated
+    IntervalSet keys_;          ///< keys the query probes
+    unsigned long long width_;
+    unsigned long long first_;  ///< chunk of parts_[0]
+    vector<agg_value> parts_;
+};
+
+/**
+ * Aggregates of an output column of the join per chunk of keys, chunk c
+ * holding keys [c * width, (c + 1) * width - 1]. A chunk is kept once a
+ * query has probed all of its keys, so later aggregate queries combine
+ * the chunks they cover whole and probe only the keys at their edges.
+ */
+class ChunkAggregates
+{
+    public:
+        ChunkAggregates(unsigned long long width) : width_(width > 0 ? width : 1) { }
+        ~ChunkAggregates();
+
+        /**
+         * Merges into \a total the kept chunks of \a column of \a key that
+         * lie in \a keys. Returns the keys of \a keys left to probe.
+         */
+        IntervalSet combine(const result_key& key, unsigned int column, const IntervalSet& keys,
+                agg_value& total);
+
+        /**
+         * Starts aggregating \a column of the output of the query \a key on
+         * \a keys. Hand the node to the joiner, then to publish() once the
+         * probe is over.
+         */
+        agg_node* record(const result_key& key, unsigned int column, const IntervalSet& keys);
+
+        /**
+         * Merges all \a node saw into \a total and keeps its chunks that
+         * lie in the keys it probed. Deletes \a node.
+         */
+        void publish(agg_node* node, agg_value& total);
+
+    private:
+        struct entry
+        {
+            result_key key_;
+            unsigned int column_;
+            map<unsigned long long, agg_value> chunks_;
+        };
+
+        entry* find(const result_key& key, unsigned int column);
+
+        unsigned long long width_;
+        vector<entry*> entries_;
+};
+
+#endif // AGGREGATES_H
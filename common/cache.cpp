@@ -17,66 +17,292 @@
 
 #include "cache.h"
 #include "exceptions.h"
+#include "hash.h"
+#include "atomics.h"
 #include<stdio.h>
 #include<stdlib.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fstream>
+#include<algorithm>
+#include<list>
+#include<string>
+#include<vector>
 
 using namespace std;
 
+const double ReuseCache::REUSE_RATIO_ = 0.3;
+const double ReuseCache::ADMIT_BENEFIT_ = 1.0;
+
+/*
+ * Snapshot file: a header, one entry per node, then the node sections at
+ * page-aligned offsets so each can be mapped on its own.
+ */
+static const char SNAPSHOT_MAGIC[8] = {'R','E','U','S','E','C','0','7'};
+static const unsigned int SNAPSHOT_COLUMNS = 16;    ///< nodes with more are not saved
+static const unsigned int SNAPSHOT_NAME = 256;      ///< nor with longer table names
+
+struct snapshot_header
+{
+    char magic_[8];
+    unsigned long long nnodes_;
+};
+
+struct snapshot_entry
+{
+    unsigned int key_table_;
+    unsigned int key_jattr_;
+    unsigned int key_store_;
+    unsigned int key_columns_[SNAPSHOT_COLUMNS];
+    unsigned int pad_;
+    unsigned long long key_ncolumns_;
+    unsigned long long start_value_;
+    unsigned long long end_value_;
+    unsigned long long chunk_width_;
+    unsigned long long offset_;     ///< of the section in the file
+    unsigned long long length_;
+    unsigned long long table_;      ///< of the table image in the section
+    char key_name_[SNAPSHOT_NAME];  ///< NUL-terminated
+};
+
+cache_key::cache_key(const string& table, unsigned int jattr, const vector<unsigned int>& columns,
+        unsigned int store)
+    : table_(murmurhash2(table.data(), table.size(), 0)), name_(table), jattr_(jattr), store_(store),
+      columns_(columns)
+{
+}
+
+bool cache_key::covers(const cache_key& want) const
+{
+    if (table_ != want.table_ || jattr_ != want.jattr_ || !(store_ & want.store_)
+            || name_ != want.name_ || !filter_.subsumes(want.filter_))
+    {
+        return false;
+    }
+    for (unsigned int i = 0; i < want.columns_.size(); ++i)
+    {
+        if (find(columns_.begin(), columns_.end(), want.columns_[i]) == columns_.end())
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
 ht_node* ReuseCache::insert(
-   unsigned long long start,
-   unsigned long long end,
+   const cache_key& key,
+   const IntervalSet& want,
    unsigned int bucksize,
-   unsigned int tuplesize)
-{
-    if(NULL != cache_head_)
-    {
-        ht_node* node = (ht_node*)malloc(sizeof(ht_node));
-        node->start_value_ = start;
-        node->end_value_ = end;
-        node->hashtable_ = (HashTable*)malloc(sizeof(HashTable));
-        node->hashtable_->init((end-start)/2,bucksize,tuplesize);
-        node->next_ = cache_head_;
-        cache_head_ = node;
-        cache_head_->init_ = true;
-        curr_cache_size_ = curr_cache_size_ + end - start;
+   unsigned int tuplesize,
+   unsigned int keysize,
+   bool account)
+{
+    unsigned long long start = want.lo();
+    unsigned long long end = want.hi();
+    ht_node* node = new ht_node();
+    node->key_ = key;
+    // the build fills in ranges_, the hull sizes the chunks meanwhile
+    node->start_value_ = start;
+    node->end_value_ = end;
+    // a bucket page per slots tuples of the range
+    unsigned int slots = bucksize > tuplesize ? bucksize / tuplesize : 1;
+    unsigned int nbuckets = (unsigned int)(estimate_rows(key, want) / slots);
+    const ColumnStats* stats = find_stats(key);
+    unsigned long long nkeys = stats ? 1 : want.width();
+    for (unsigned int i = 0; stats && i < want.size(); ++i)
+    {
+        nkeys += (unsigned long long)stats->estimate_distinct(want.get_lo(i), want.get_hi(i));
+    }
+    node->hashtable_ = new HashTable();
+    // keys are stored relative to the first range, keysize - 4 bytes saved per entry
+    bool narrow = keysize > sizeof(int);
+    node->hashtable_->init(nbuckets,bucksize,narrow ? tuplesize - keysize + sizeof(int) : tuplesize);
+    if (narrow)
+    {
+        node->hashtable_->set_key_base(start);
+        if (!node->hashtable_->fits(start, end))
+        {
+            node->hashtable_->destroy();
+            node->hashtable_->init(nbuckets,bucksize,tuplesize);
+        }
+    }
+    node->bloom_ = new BloomFilter();
+    node->bloom_->init(nkeys);
+    node->refs_ = 1;
+    node->init_ = true;
+    // the buckets are sized for the estimated rows already
+    node->transient_ = !admit(key, want, node->hashtable_->get_size() + node->bloom_->get_size(), account);
+    node->chunk_width_ = (end-start)/CHUNKS_PER_NODE_ + 1;
+    if (account)
+    {
+        touch(node, start, end);
+    }
+    if (node->transient_ && account)
+    {
+        __sync_fetch_and_add(&stats_.rejected_, 1);
+        cout << "Not admitted, transient hashtable["<<start<<","<<end<<"]"<<flush<<endl;
+    }
+
+    return node;
+}
+
+double ReuseCache::overlap_ratio(const cache_key& key, const IntervalSet& want, const IntervalSet& other)
+{
+    if (want.lo() > other.hi() || other.lo() > want.hi() || !want.overlaps(other))
+    {
+        return 0;
+    }
+    IntervalSet all = want.unite(other);
+    if (find_stats(key))
+    {
+        double rows = estimate_rows(key, all);
+        if (rows > 0)
+        {
+            return estimate_rows(key, want) / rows;
+        }
+    }
+    return (double)want.width() / all.width();
+}
+
+bool ReuseCache::admit(const cache_key& key, const IntervalSet& want, unsigned long long bytes, bool account)
+{
+    unsigned long long start = want.lo();
+    unsigned long long end = want.hi();
+    if (curr_cache_size_ + (end - start) <= max_cache_size_
+            && (0 == max_cache_bytes_ || get_used_bytes() + bytes <= max_cache_bytes_))
+    {
+        return true;
+    }
+
+    ghost_lock_.lock();
+    double benefit = 0;
+    for (unsigned int i = 0; i < nghosts_; ++i)
+    {
+        benefit += overlap_ratio(key, want, ghosts_[i].ranges_);
+    }
+    bool admitted = benefit >= ADMIT_BENEFIT_;
+    if (!admitted && account)
+    {
+        ghosts_[next_ghost_].ranges_ = want;
+        next_ghost_ = (next_ghost_ + 1) % MAX_GHOSTS_;
+        nghosts_ = nghosts_ < MAX_GHOSTS_ ? nghosts_ + 1 : MAX_GHOSTS_;
+    }
+    ghost_lock_.unlock();
+    return admitted;
+}
+
+void ReuseCache::push(ht_node* node)
+{
+    ht_node* head;
+    do
+    {
+        head = cache_head_;
+        node->next_ = head;
+    }
+    while (atomic_compare_and_swap((void**)&cache_head_, head, node) != head);
+
+    if(NULL != head)
+    {
         cout<< "head is not null!"<<flush<<endl;
     }
     else
     {
-        cache_head_ = (ht_node*)malloc(sizeof(ht_node));
-        cache_head_->start_value_ = start;
-        cache_head_->end_value_ = end;
-        cache_head_->hashtable_ = (HashTable*)malloc(sizeof(HashTable));
-        cache_head_->hashtable_->init((end-start)/2,bucksize,tuplesize);
-        cache_head_->init_ = true;
-        cache_head_->next_ =NULL;
         cout<< "head is null!"<<flush<<endl;
-        curr_cache_size_ = curr_cache_size_+ end - start;
     }
+}
 
-    return cache_head_;
+ht_node* ReuseCache::draft(ht_node* origin)
+{
+    ht_node* node = new ht_node();
+    node->hashtable_ = new HashTable();
+    node->hashtable_->clone(origin->hashtable_);
+    node->bloom_ = new BloomFilter();
+    node->bloom_->clone(origin->bloom_);
+    node->key_ = origin->key_;
+    node->set_ranges(origin->ranges_);
+    node->refs_ = 1;
+    node->origin_ = origin;
+    node->base_tuples_ = origin->hashtable_->get_tuple_num();
+    node->chunk_width_ = origin->chunk_width_;
+    origin->access_lock_.lock();
+    node->access_ = origin->access_;
+    node->overlap_sum_ = origin->overlap_sum_;
+    node->reuses_ = origin->reuses_;
+    origin->access_lock_.unlock();
+    return node;
 }
 
+void ReuseCache::publish(ht_node* node)
+{
+    if (node->published_)
+    {
+        return;
+    }
+    refresh_filter(node);
+    if (node->transient_)
+    {
+        return;
+    }
+    writer_lock_.lock();
+    node->published_ = true;
+    ht_node* origin = node->origin_;
+    node->origin_ = NULL;
 
-ht_node* ReuseCache::get_reusable_ht(unsigned long long start, unsigned long long end)
+    ht_node** link = (ht_node**)&cache_head_;
+    while (origin && *link && *link != origin)
+    {
+        link = (ht_node**)&(*link)->next_;
+    }
+    if (origin && *link == origin)
+    {
+        node->next_ = origin->next_;
+        replace(link, origin, node);
+        __sync_fetch_and_add(&curr_cache_size_, (node->end_value_ - node->start_value_)
+                - (origin->end_value_ - origin->start_value_));
+        link_bytes(node);
+        unlink_bytes(origin);
+        retire(origin);
+    }
+    else
+    {
+        // fresh node, or another query replaced the origin first
+        push(node);
+        __sync_fetch_and_add(&curr_cache_size_, node->end_value_ - node->start_value_);
+        link_bytes(node);
+    }
+    if (origin)
+    {
+        __sync_fetch_and_sub(&origin->refs_, 1);
+    }
+    reclaim();
+    writer_lock_.unlock();
+}
+
+
+ht_node* ReuseCache::get_reusable_ht(const cache_key& key, const IntervalSet& want, bool account)
 {
+    unsigned long long start = want.lo();
+    unsigned long long end = want.hi();
     ht_node* ret = NULL;
     ht_node* target = NULL;
+    epoch_.enter();
     ret = cache_head_;
     double ratio = 0;
     while(NULL != ret)
     {
-        if(ret->start_value_ >= end || ret->end_value_ <= start)
+        // nodes claimed by a writer are not reusable
+        if(ret->dead_ || !want.overlaps(ret->ranges_) || !ret->key_.covers(key)
+                || !ret->hashtable_->fits(start < ret->start_value_ ? start : ret->start_value_,
+                    end > ret->end_value_ ? end : ret->end_value_))
         {
 
         }
         else
         {
-            unsigned long long interval1 = end - start;
-            unsigned long long interval2 = (ret->end_value_ >= end ? ret->end_value_ : end)
-                    - (ret->start_value_ <= start ? ret->start_value_ : start);
-            double tmp_ratio = (double)(interval1*1.0/interval2);
+            // a node that holds every key is a hit however narrow the query
+            double tmp_ratio = ret->ranges_.contains(want) ? 1 : overlap_ratio(key, want, ret->ranges_);
             cout<< "tmp_ratio is "<<tmp_ratio<<flush<<endl;
             if(ratio < tmp_ratio)
             {
@@ -87,24 +313,61 @@ ht_node* ReuseCache::get_reusable_ht(unsigned long long start, unsigned long lon
         }
         ret =  ret->next_;
     }
-    if(ratio >= 0.3)
+    if(ratio < REUSE_RATIO_ && max_frozen_size_ > 0)
+    {
+        ht_node* frozen = thaw(key, want, ratio);
+        if(frozen != NULL)
+        {
+            target = frozen;
+        }
+    }
+    if(ratio < REUSE_RATIO_ && max_spill_size_ > 0)
+    {
+        ht_node* spilled = fault_in(key, want, ratio);
+        if(spilled != NULL)
+        {
+            target = spilled;
+        }
+    }
+    if(account)
     {
-        curr_cache_size_ = curr_cache_size_ - (target->end_value_ - target->start_value_);
-        unsigned long long start_value = start < target->start_value_ ? start : target->start_value_;
-        unsigned long long end_value = end > target->end_value_ ? end : target->end_value_;
-        curr_cache_size_ = curr_cache_size_ + (end_value - start_value);
-        return target;
+        record_overlap(ratio);
+    }
+    if(ratio >= REUSE_RATIO_ && pin(target))
+    {
+        if(account)
+        {
+            touch(target, start, end);
+            record_reuse(target, ratio);
+            // tuples of the query keys that are already there
+            double all = estimate_rows(key, target->ranges_);
+            __sync_fetch_and_add(&stats_.reused_tuples_, (unsigned long long)(all > 0
+                    ? target->hashtable_->get_tuple_num() * estimate_rows(key, want.intersect(target->ranges_)) / all
+                    : 0));
+            __sync_fetch_and_add(target->ranges_.contains(want) ? &stats_.hits_ : &stats_.partial_hits_, 1);
+        }
+        if(!target->ranges_.contains(want))
+        {
+            // the origin stays pinned by the draft until publish()
+            target = draft(target);
+        }
     }
     else
     {
-        return NULL;
+        if(account)
+        {
+            __sync_fetch_and_add(&stats_.misses_, 1);
+        }
+        target = NULL;
     }
+    epoch_.exit();
+    return target;
 }
 
 
 void ReuseCache::add_cache(unsigned long long addtional_cache)
 {
-    curr_cache_size_ = curr_cache_size_+addtional_cache;
+    __sync_fetch_and_add(&curr_cache_size_, addtional_cache);
 }
 
 void ReuseCache::destroy()
@@ -113,38 +376,472 @@ void ReuseCache::destroy()
     while (cache_head_ != NULL) {
         node = cache_head_;
         cache_head_ = cache_head_->next_;
-        node->hashtable_->destroy();
-        delete node->hashtable_;
-        delete node;
+        free_node(node);
+    }
+    while (retired_ != NULL) {
+        node = retired_;
+        retired_ = retired_->retired_next_;
+        free_node(node);
+    }
+    epoch_.destroy();
+    // the disk tier only lives as long as the process, see save() for that
+    for (list<spilled_node>::iterator it = spilled_.begin(); it != spilled_.end(); ++it)
+    {
+        unlink(it->path_.c_str());
+    }
+    spilled_.clear();
+    curr_spill_size_ = 0;
+    for (list<frozen_node>::iterator it = frozen_.begin(); it != frozen_.end(); ++it)
+    {
+        it->table_->destroy();
+        delete it->table_;
+    }
+    frozen_.clear();
+    curr_frozen_size_ = 0;
+    frozen_raw_size_ = 0;
+}
+
+void ReuseCache::refresh_filter(ht_node* node)
+{
+    HashTable* ht = node->hashtable_;
+    // no more distinct keys than tuples, however wide the ranges
+    const ColumnStats* stats = find_stats(node->key_);
+    unsigned long long nkeys = stats ? 1 : node->ranges_.width();
+    for (unsigned int i = 0; stats && i < node->ranges_.size(); ++i)
+    {
+        nkeys += (unsigned long long)stats->estimate_distinct(node->ranges_.get_lo(i), node->ranges_.get_hi(i));
+    }
+    if (nkeys > ht->get_tuple_num())
+    {
+        nkeys = ht->get_tuple_num();
+    }
+    if (nkeys <= node->bloom_->get_capacity())
+    {
+        return;
+    }
+
+    BloomFilter* bloom = new BloomFilter();
+    bloom->init(nkeys);
+    HashTable::Iterator it = ht->create_iterator();
+    for (unsigned int i = 0; i < ht->get_bucket_num(); ++i)
+    {
+        void* tup;
+        ht->place_iterator(it, i);
+        while ((tup = it.read_next()))
+        {
+            bloom->add(ht->hash(ht->get_key(tup)));
+        }
+    }
+    // the filter is complete before a reader can load the new pointer
+    BloomFilter* old = __sync_lock_test_and_set(&node->bloom_, bloom);
+    __sync_synchronize();
+    node->bytes_ = 0;
+    epoch_.retire(old, free_filter);
+}
+
+void ReuseCache::free_filter(void* p)
+{
+    BloomFilter* bloom = (BloomFilter*)p;
+    bloom->destroy();
+    delete bloom;
+}
+
+void ReuseCache::free_node(void* p)
+{
+    ht_node* node = (ht_node*)p;
+    node->hashtable_->destroy();
+    delete node->hashtable_;
+    node->bloom_->destroy();
+    delete node->bloom_;
+    if (node->map_addr_)
+    {
+        munmap(node->map_addr_, node->map_len_);
+    }
+    delete node;
+}
+
+void ReuseCache::touch(ht_node* node, unsigned long long start, unsigned long long end)
+{
+    node->access_lock_.lock();
+    for (unsigned long long c = start / node->chunk_width_; c <= end / node->chunk_width_; ++c)
+    {
+        ++node->access_[c];
+    }
+    node->access_lock_.unlock();
+}
+
+void ReuseCache::record_reuse(ht_node* node, double ratio)
+{
+    node->access_lock_.lock();
+    node->overlap_sum_ += ratio;
+    ++node->reuses_;
+    node->access_lock_.unlock();
+}
+
+bool ReuseCache::pin(ht_node* node)
+{
+    __sync_fetch_and_add(&node->refs_, 1);
+    if (node->dead_)
+    {
+        __sync_fetch_and_sub(&node->refs_, 1);
+        return false;
+    }
+    return true;
+}
+
+bool ReuseCache::seize(ht_node* node)
+{
+    node->dead_ = true;
+    __sync_synchronize();
+    if (node->refs_ != 0)
+    {
+        node->dead_ = false;
+        return false;
+    }
+    return true;
+}
+
+ht_node** ReuseCache::replace(ht_node** link, ht_node* node, ht_node* repl)
+{
+    // repl must be complete before lookups can reach it
+    __sync_synchronize();
+    if (link == &cache_head_)
+    {
+        if (atomic_compare_and_swap((void**)&cache_head_, node, repl) == node)
+        {
+            return link;
+        }
+        // insert() pushed new heads in front of node, only heads change
+        // without writer_lock_
+        link = (ht_node**)&cache_head_->next_;
+        while (*link != node)
+        {
+            link = (ht_node**)&(*link)->next_;
+        }
+    }
+    *link = repl;
+    return link;
+}
+
+void ReuseCache::retire(ht_node* node)
+{
+    node->dead_ = true;
+    // the store of dead_ must not pass the loads of refs_ in reclaim(),
+    // see pin()
+    __sync_synchronize();
+    node->retired_next_ = retired_;
+    retired_ = node;
+}
+
+void ReuseCache::release(ht_node* node)
+{
+    if (!node->published_)
+    {
+        if (node->origin_)
+        {
+            __sync_fetch_and_sub(&node->origin_->refs_, 1);
+        }
+        free_node(node);
+        return;
+    }
+    __sync_fetch_and_sub(&node->refs_, 1);
+    // a writer holding the lock reclaims on its way out
+    if (writer_lock_.try_lock())
+    {
+        reclaim();
+        writer_lock_.unlock();
+    }
+}
+
+void ReuseCache::reclaim()
+{
+    ht_node** link = &retired_;
+    // a pin() that raced with retire() either shows in refs_ now or sees
+    // dead_ and backs off
+    __sync_synchronize();
+    while (*link != NULL)
+    {
+        ht_node* node = *link;
+        if (node->refs_ == 0)
+        {
+            *link = node->retired_next_;
+            cout << "Free retired HashTable:["<<node->start_value_<<","<<node->end_value_<<"]"<<flush<<endl;
+            epoch_.retire(node, free_node);
+        }
+        else
+        {
+            link = &node->retired_next_;
+        }
+    }
+    epoch_.reclaim();
+}
+
+/*
+ * Entries of both stores start with the join key, see HashTable::get_key().
+ */
+ht_node* ReuseCache::merge(ht_node* large, ht_node* small)
+{
+    ht_node* node = new ht_node();
+    node->hashtable_ = new HashTable();
+    node->hashtable_->clone(large->hashtable_);
+    node->bloom_ = new BloomFilter();
+    node->bloom_->clone(large->bloom_);
+
+    unsigned long long copied = 0;
+    HashTable* src = small->hashtable_;
+    HashTable::Iterator it = src->create_iterator();
+    // same layout, see mergeable(), only the key offsets move to the new base
+    char entry[src->get_tuple_size()];
+    for (unsigned int i = 0; i < src->get_bucket_num(); ++i)
+    {
+        void* tup;
+        src->place_iterator(it, i);
+        while ((tup = it.read_next()))
+        {
+            unsigned long long key = src->get_key(tup);
+            if (large->ranges_.contains(key))
+            {
+                continue;
+            }
+            HashTable::hash_t hash = node->hashtable_->hash(key);
+            memcpy(entry, tup, sizeof(entry));
+            node->hashtable_->put_key(entry, key);
+            node->hashtable_->insert(hash, entry);
+            node->bloom_->add(hash);
+            ++copied;
+        }
+    }
+
+    node->key_ = large->key_;
+    node->set_ranges(large->ranges_.unite(small->ranges_));
+    node->published_ = true;
+    node->chunk_width_ = large->chunk_width_;
+    node->access_ = large->access_;
+    for (map<unsigned long long, unsigned long long>::iterator c = small->access_.begin();
+            c != small->access_.end(); ++c)
+    {
+        node->access_[c->first * small->chunk_width_ / node->chunk_width_] += c->second;
+    }
+    node->overlap_sum_ = large->overlap_sum_ + small->overlap_sum_;
+    node->reuses_ = large->reuses_ + small->reuses_;
+    cout << "Merge HashTable:["<<large->start_value_<<","<<large->end_value_<<"] and ["
+         <<small->start_value_<<","<<small->end_value_<<"], rehashed "<<copied<<" tuples"<<flush<<endl;
+    return node;
+}
+
+bool ReuseCache::mergeable(ht_node* a, ht_node* b)
+{
+    unsigned long long lo = a->start_value_ < b->start_value_ ? a->start_value_ : b->start_value_;
+    unsigned long long hi = a->end_value_ > b->end_value_ ? a->end_value_ : b->end_value_;
+    return a->key_ == b->key_
+        && a->hashtable_->get_key_width() == b->hashtable_->get_key_width()
+        && a->hashtable_->get_hash_width() == b->hashtable_->get_hash_width()
+        && a->hashtable_->fits(lo, hi) && b->hashtable_->fits(lo, hi);
+}
+
+void ReuseCache::compact()
+{
+    writer_lock_.lock();
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (ht_node** a = (ht_node**)&cache_head_; *a != NULL && !merged; a = (ht_node**)&(*a)->next_)
+        {
+            for (ht_node** b = (ht_node**)&(*a)->next_; *b != NULL; b = (ht_node**)&(*b)->next_)
+            {
+                ht_node* na = *a;
+                ht_node* nb = *b;
+                // entries of different keys have different layouts
+                if (na->start_value_ > nb->end_value_ || nb->start_value_ > na->end_value_
+                        || !mergeable(na, nb))
+                {
+                    continue;
+                }
+                // pinned nodes are being probed, or copied by a draft
+                if (!seize(na))
+                {
+                    break;
+                }
+                if (!seize(nb))
+                {
+                    na->dead_ = false;
+                    continue;
+                }
+
+                bool a_large = na->hashtable_->get_tuple_num() >= nb->hashtable_->get_tuple_num();
+                ht_node* node = a_large ? merge(na, nb) : merge(nb, na);
+
+                // unlink b first, a's link stays valid
+                *b = nb->next_;
+                node->next_ = na->next_;
+                replace(a, na, node);
+
+                __sync_fetch_and_add(&curr_cache_size_, (node->end_value_ - node->start_value_)
+                        - (na->end_value_ - na->start_value_)
+                        - (nb->end_value_ - nb->start_value_));
+                link_bytes(node);
+                unlink_bytes(na);
+                unlink_bytes(nb);
+
+                retire(na);
+                retire(nb);
+                __sync_fetch_and_add(&stats_.merges_, 1);
+                merged = true;
+                break;
+            }
+        }
+    }
+    reclaim();
+    writer_lock_.unlock();
+}
+
+bool ReuseCache::trim(ht_node** link)
+{
+    ht_node* node = *link;
+    if (!seize(node))
+    {
+        return false;
+    }
+
+    unsigned long long hottest = 0;
+    for (map<unsigned long long, unsigned long long>::iterator c = node->access_.begin();
+            c != node->access_.end(); ++c)
+    {
+        hottest = c->second > hottest ? c->second : hottest;
+    }
+
+    unsigned long long w = node->chunk_width_;
+    unsigned long long first = node->start_value_ / w;
+    unsigned long long last = node->end_value_ / w;
+    unsigned long long lo = first;
+    unsigned long long hi = last;
+    while (lo < hi && node->accesses(lo) * COLD_RATIO_ < hottest)
+    {
+        ++lo;
+    }
+    while (hi > lo && node->accesses(hi) * COLD_RATIO_ < hottest)
+    {
+        --hi;
+    }
+    if (lo == first && hi == last)
+    {
+        node->dead_ = false;
+        return false;
     }
+
+    unsigned long long start = lo == first ? node->start_value_ : lo * w;
+    unsigned long long end = hi == last ? node->end_value_ : hi * w + w - 1;
+
+    ht_node* trimmed = new ht_node();
+    trimmed->hashtable_ = new HashTable();
+    trimmed->hashtable_->clone(node->hashtable_, start, end);
+    // a superset of the remaining keys, so it still never says no wrongly
+    trimmed->bloom_ = new BloomFilter();
+    trimmed->bloom_->clone(node->bloom_);
+    trimmed->key_ = node->key_;
+    trimmed->set_ranges(node->ranges_.intersect(IntervalSet(start, end)));
+    trimmed->published_ = true;
+    trimmed->chunk_width_ = w;
+    trimmed->access_.insert(node->access_.lower_bound(lo), node->access_.upper_bound(hi));
+    trimmed->overlap_sum_ = node->overlap_sum_;
+    trimmed->reuses_ = node->reuses_;
+
+    __sync_fetch_and_add(&stats_.trims_, 1);
+    cout << "Trim HashTable:["<<node->start_value_<<","<<node->end_value_<<"] to ["
+         <<start<<","<<end<<"], kept "<<trimmed->hashtable_->get_tuple_num()
+         <<" of "<<node->hashtable_->get_tuple_num()<<" tuples"<<flush<<endl;
+
+    __sync_fetch_and_add(&curr_cache_size_, (trimmed->end_value_ - trimmed->start_value_)
+            - (node->end_value_ - node->start_value_));
+    trimmed->next_ = node->next_;
+    replace(link, node, trimmed);
+    link_bytes(trimmed);
+    unlink_bytes(node);
+    retire(node);
+    return true;
+}
+
+double ReuseCache::keep_score(ht_node* node)
+{
+    node->access_lock_.lock();
+    unsigned long long reuses = node->reuses_;
+    node->access_lock_.unlock();
+    return (reuses + 1) * estimate_rows(node->key_, node->ranges_) / (node_bytes(node) + 1);
+}
+
+static bool score_less(const pair<double, ht_node*>& a, const pair<double, ht_node*>& b)
+{
+    return a.first < b.first;
+}
+
+vector<ht_node*> ReuseCache::eviction_order()
+{
+    // the list runs from the newest node, so oldest first among equals
+    vector<pair<double, ht_node*> > scored;
+    for (ht_node* node = cache_head_; node != NULL; node = node->next_)
+    {
+        scored.push_back(make_pair(keep_score(node), node));
+    }
+    reverse(scored.begin(), scored.end());
+    stable_sort(scored.begin(), scored.end(), score_less);
+    vector<ht_node*> order;
+    for (unsigned int i = 0; i < scored.size(); ++i)
+    {
+        order.push_back(scored[i].second);
+    }
+    return order;
+}
+
+ht_node** ReuseCache::link_of(ht_node* node)
+{
+    ht_node** link = (ht_node**)&cache_head_;
+    while (*link != node)
+    {
+        link = (ht_node**)&(*link)->next_;
+    }
+    return link;
 }
 
 void ReuseCache::garbage_collection()
 {
-    if(curr_cache_size_ > max_cache_size_)
+    if(over_budget())
     {
-       unsigned long long size = 0;
-       ht_node* node = cache_head_;
-       ht_node* pre_node = cache_head_;
-       while(node)
+       writer_lock_.lock();
+       // give back cold edges of the tables least worth keeping first
+       vector<ht_node*> order = eviction_order();
+       for (unsigned int i = 0; i < order.size() && over_budget(); ++i)
+       {
+           trim(link_of(order[i]));
+       }
+
+       // trimmed nodes were replaced, score what is linked now
+       order = eviction_order();
+       for (unsigned int i = 0; i < order.size() && over_budget(); ++i)
        {
-           size = size + node->end_value_ - node->start_value_;
-           if(size > max_cache_size_)
+           // pinned nodes are being probed, a later collection gets them
+           ht_node* tmp = order[i];
+           if (!seize(tmp))
            {
-               ht_node* p = node;
-               while(p)
-               {
-                   ht_node* tmp = p;
-                   p = p->next_;
-                   cout<<"Collect HashTable:["<<tmp->start_value_<<","<<tmp->end_value_<<"]"<<flush<<endl;
-                   delete tmp;
-               }
-               pre_node->next_  = NULL;
-               break;
+               continue;
            }
-           pre_node = node;
-           node = node->next_;
+           replace(link_of(tmp), tmp, tmp->next_);
+           __sync_fetch_and_add(&stats_.evictions_, 1);
+           if (max_frozen_size_ > 0)
+           {
+               freeze(tmp);
+           }
+           else if (max_spill_size_ > 0)
+           {
+               spill(tmp);
+           }
+           cout<<"Collect HashTable:["<<tmp->start_value_<<","<<tmp->end_value_<<"]"<<flush<<endl;
+           __sync_fetch_and_sub(&curr_cache_size_, tmp->end_value_ - tmp->start_value_);
+           unlink_bytes(tmp);
+           retire(tmp);
        }
+       reclaim();
+       writer_lock_.unlock();
        cout<< "Finish Garbage Collection!"<< flush<< endl;
     }
     else
@@ -153,28 +850,600 @@ void ReuseCache::garbage_collection()
     }
 }
 
+unsigned long long ReuseCache::node_bytes(ht_node* node)
+{
+    // published tables never change, racing counters store the same value
+    if (0 == node->bytes_)
+    {
+        node->bytes_ = node->hashtable_->get_size() + node->bloom_->get_size();
+    }
+    return node->bytes_;
+}
+
+bool ReuseCache::over_budget()
+{
+    return curr_cache_size_ > max_cache_size_
+        || (max_cache_bytes_ > 0 && get_used_bytes() > max_cache_bytes_);
+}
+
+void ReuseCache::set_stats(const cache_key& key, const ColumnStats* stats)
+{
+    column_stats_[make_pair(key.name_, key.jattr_)] = stats;
+}
+
+const ColumnStats* ReuseCache::find_stats(const cache_key& key)
+{
+    map<pair<string, unsigned int>, const ColumnStats*>::const_iterator it =
+        column_stats_.find(make_pair(key.name_, key.jattr_));
+    return it == column_stats_.end() ? NULL : it->second;
+}
+
+double ReuseCache::estimate_rows(const cache_key& key, const IntervalSet& keys)
+{
+    const ColumnStats* stats = find_stats(key);
+    if (NULL == stats)
+    {
+        return (double)keys.width();
+    }
+    double rows = 0;
+    for (unsigned int i = 0; i < keys.size(); ++i)
+    {
+        rows += stats->estimate_rows(keys.get_lo(i), keys.get_hi(i));
+    }
+    return rows;
+}
+
 
 void ReuseCache::print_cache()
 {
+    epoch_.enter();
     ht_node* node = cache_head_;
     while(node != NULL)
     {
-        cout<< "hashtable["<<node->start_value_<<","<<node->end_value_<<"]"<<flush<<endl;
+        cout<< "hashtable["<<node->start_value_<<","<<node->end_value_<<"]"
+            << " bloom fpr: "<<node->bloom_->false_positive_rate()<<flush<<endl;
         node = node->next_;
     }
+    epoch_.exit();
+}
+
+void ReuseCache::record_overlap(double ratio)
+{
+    unsigned int tenth = (unsigned int)(ratio * 10);
+    __sync_fetch_and_add(&stats_.overlap_[tenth < 10 ? tenth : 9], 1);
+}
+
+void ReuseCache::record_build(ht_node* node, unsigned long long cycles)
+{
+    // published nodes are full hits, nothing was built
+    if (node->published_)
+    {
+        return;
+    }
+    unsigned long long built = node->hashtable_->get_tuple_num() - node->base_tuples_;
+    if (node->origin_ != NULL)
+    {
+        __sync_fetch_and_add(&stats_.extended_tuples_, built);
+    }
+    __sync_fetch_and_add(&stats_.built_tuples_, built);
+    __sync_fetch_and_add(&stats_.build_cycles_, cycles);
+}
+
+unsigned long long ReuseCache::get_build_cycles_saved()
+{
+    if (stats_.built_tuples_ == 0)
+    {
+        return 0;
+    }
+    return (unsigned long long)((double)stats_.build_cycles_ / stats_.built_tuples_ * stats_.reused_tuples_);
+}
+
+void ReuseCache::dump_csv(ostream& out)
+{
+    cache_stats st = stats_;
+    out << "cache,hits,partial_hits,misses,rejected,evictions,merges,trims,spills,faults,"
+        << "freezes,deep_freezes,thaws,frozen_size,capacity_gain,"
+        << "extended_tuples,built_tuples,build_cycles,reused_tuples,build_cycles_saved,size,max_size,"
+        << "bytes,max_bytes";
+    for (unsigned int i = 0; i < 10; ++i)
+    {
+        out << ",overlap_" << i;
+    }
+    out << "\n";
+    out << "cache," << st.hits_ << "," << st.partial_hits_ << "," << st.misses_ << ","
+        << st.rejected_ << "," << st.evictions_ << "," << st.merges_ << "," << st.trims_ << ","
+        << st.spills_ << "," << st.faults_ << ","
+        << st.freezes_ << "," << st.deep_freezes_ << "," << st.thaws_ << ","
+        << curr_frozen_size_ << "," << get_capacity_gain() << ","
+        << st.extended_tuples_ << "," << st.built_tuples_ << "," << st.build_cycles_ << ","
+        << st.reused_tuples_ << "," << get_build_cycles_saved() << ","
+        << curr_cache_size_ << "," << max_cache_size_ << ","
+        << get_bytes() << "," << max_cache_bytes_;
+    for (unsigned int i = 0; i < 10; ++i)
+    {
+        out << "," << st.overlap_[i];
+    }
+    out << "\n";
+
+    out << "node,start,end,tuples,buckets,bytes,avg_chain,accesses,bloom_fpr,avg_overlap\n";
+    epoch_.enter();
+    for (ht_node* node = cache_head_; node != NULL; node = node->next_)
+    {
+        unsigned long long pages, chains, accesses = 0;
+        node->hashtable_->get_chain_stats(pages, chains);
+        node->access_lock_.lock();
+        for (map<unsigned long long, unsigned long long>::iterator c = node->access_.begin();
+                c != node->access_.end(); ++c)
+        {
+            accesses = c->second > accesses ? c->second : accesses;
+        }
+        double overlap = node->reuses_ ? node->overlap_sum_ / node->reuses_ : 0;
+        node->access_lock_.unlock();
+        out << "node," << node->start_value_ << "," << node->end_value_ << ","
+            << node->hashtable_->get_tuple_num() << "," << node->hashtable_->get_bucket_num() << ","
+            << node->hashtable_->get_size() + node->bloom_->get_size() << ","
+            << (chains ? (double)pages / chains : 0) << "," << accesses << ","
+            << node->bloom_->false_positive_rate() << "," << overlap << "\n";
+    }
+    epoch_.exit();
+    out << flush;
+}
+
+void ReuseCache::dump_json(ostream& out)
+{
+    cache_stats st = stats_;
+    out << "{\"hits\":" << st.hits_
+        << ",\"partial_hits\":" << st.partial_hits_
+        << ",\"misses\":" << st.misses_
+        << ",\"rejected\":" << st.rejected_
+        << ",\"evictions\":" << st.evictions_
+        << ",\"merges\":" << st.merges_
+        << ",\"trims\":" << st.trims_
+        << ",\"spills\":" << st.spills_
+        << ",\"faults\":" << st.faults_
+        << ",\"freezes\":" << st.freezes_
+        << ",\"deep_freezes\":" << st.deep_freezes_
+        << ",\"thaws\":" << st.thaws_
+        << ",\"frozen_size\":" << curr_frozen_size_
+        << ",\"capacity_gain\":" << get_capacity_gain()
+        << ",\"extended_tuples\":" << st.extended_tuples_
+        << ",\"built_tuples\":" << st.built_tuples_
+        << ",\"build_cycles\":" << st.build_cycles_
+        << ",\"reused_tuples\":" << st.reused_tuples_
+        << ",\"build_cycles_saved\":" << get_build_cycles_saved()
+        << ",\"size\":" << curr_cache_size_
+        << ",\"max_size\":" << max_cache_size_
+        << ",\"bytes\":" << get_bytes()
+        << ",\"max_bytes\":" << max_cache_bytes_
+        << ",\"overlap\":[";
+    for (unsigned int i = 0; i < 10; ++i)
+    {
+        out << (i ? "," : "") << st.overlap_[i];
+    }
+    out << "],\"nodes\":[";
+    epoch_.enter();
+    for (ht_node* node = cache_head_; node != NULL; node = node->next_)
+    {
+        unsigned long long pages, chains, accesses = 0;
+        node->hashtable_->get_chain_stats(pages, chains);
+        node->access_lock_.lock();
+        for (map<unsigned long long, unsigned long long>::iterator c = node->access_.begin();
+                c != node->access_.end(); ++c)
+        {
+            accesses = c->second > accesses ? c->second : accesses;
+        }
+        double overlap = node->reuses_ ? node->overlap_sum_ / node->reuses_ : 0;
+        node->access_lock_.unlock();
+        out << (node != cache_head_ ? "," : "")
+            << "{\"start\":" << node->start_value_
+            << ",\"end\":" << node->end_value_
+            << ",\"tuples\":" << node->hashtable_->get_tuple_num()
+            << ",\"buckets\":" << node->hashtable_->get_bucket_num()
+            << ",\"bytes\":" << node->hashtable_->get_size() + node->bloom_->get_size()
+            << ",\"avg_chain\":" << (chains ? (double)pages / chains : 0)
+            << ",\"accesses\":" << accesses
+            << ",\"bloom_fpr\":" << node->bloom_->false_positive_rate()
+            << ",\"avg_overlap\":" << overlap << "}";
+    }
+    epoch_.exit();
+    out << "]}" << endl;
+}
+
+bool ReuseCache::write_snapshot(const char* path, const vector<ht_node*>& nodes)
+{
+    // nodes loaded from path are mapped from it, so never truncate it in place
+    string tmppath = string(path) + ".tmp";
+    ofstream out(tmppath.c_str(), ios::out | ios::binary | ios::trunc);
+    if (!out)
+    {
+        cout << "Cannot write snapshot "<<tmppath<<flush<<endl;
+        return false;
+    }
+
+    unsigned long long pagesize = sysconf(_SC_PAGESIZE);
+    vector<snapshot_entry> entries(nodes.size());
+    unsigned long long off = sizeof(snapshot_header) + nodes.size() * sizeof(snapshot_entry);
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+    {
+        off = (off + pagesize - 1) / pagesize * pagesize;
+        memset(&entries[i], 0, sizeof(snapshot_entry));
+        entries[i].key_table_ = nodes[i]->key_.table_;
+        strcpy(entries[i].key_name_, nodes[i]->key_.name_.c_str());
+        entries[i].key_jattr_ = nodes[i]->key_.jattr_;
+        entries[i].key_store_ = nodes[i]->key_.store_;
+        entries[i].key_ncolumns_ = nodes[i]->key_.columns_.size();
+        for (unsigned int c = 0; c < nodes[i]->key_.columns_.size(); ++c)
+        {
+            entries[i].key_columns_[c] = nodes[i]->key_.columns_[c];
+        }
+        entries[i].start_value_ = nodes[i]->start_value_;
+        entries[i].end_value_ = nodes[i]->end_value_;
+        entries[i].chunk_width_ = nodes[i]->chunk_width_;
+        entries[i].offset_ = off;
+        entries[i].table_ = (nodes[i]->bloom_->get_image_size() + 7) & ~7ULL;
+        entries[i].length_ = entries[i].table_ + nodes[i]->hashtable_->get_image_size();
+        off += entries[i].length_;
+    }
+
+    snapshot_header hdr;
+    memcpy(hdr.magic_, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    hdr.nnodes_ = nodes.size();
+    out.write((const char*)&hdr, sizeof(hdr));
+    if (!nodes.empty())
+    {
+        out.write((const char*)&entries[0], nodes.size() * sizeof(snapshot_entry));
+    }
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+    {
+        char* image = new char[entries[i].length_];
+        memset(image, 0, entries[i].length_);
+        nodes[i]->bloom_->serialize(image);
+        nodes[i]->hashtable_->serialize(image + entries[i].table_);
+        out.seekp(entries[i].offset_);
+        out.write(image, entries[i].length_);
+        delete[] image;
+    }
+    out.close();
+    if (!out || rename(tmppath.c_str(), path) != 0)
+    {
+        cout << "Cannot write snapshot "<<path<<flush<<endl;
+        unlink(tmppath.c_str());
+        return false;
+    }
+    return true;
 }
 
+bool ReuseCache::map_snapshot(const char* path, vector<ht_node*>& nodes)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
 
+    struct stat st;
+    snapshot_header hdr;
+    if (fstat(fd, &st) != 0 || pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)
+            || memcmp(hdr.magic_, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    {
+        cout << "Not a snapshot: "<<path<<flush<<endl;
+        close(fd);
+        return false;
+    }
+    unsigned long long size = st.st_size;
+    if (hdr.nnodes_ > (size - sizeof(hdr)) / sizeof(snapshot_entry))
+    {
+        cout << "Truncated snapshot: "<<path<<flush<<endl;
+        close(fd);
+        return false;
+    }
+    unsigned long long pagesize = sysconf(_SC_PAGESIZE);
+    vector<snapshot_entry> entries(hdr.nnodes_);
+    if (hdr.nnodes_ != 0 && pread(fd, &entries[0], hdr.nnodes_ * sizeof(snapshot_entry), sizeof(hdr))
+            != (ssize_t)(hdr.nnodes_ * sizeof(snapshot_entry)))
+    {
+        cout << "Truncated snapshot: "<<path<<flush<<endl;
+        close(fd);
+        return false;
+    }
 
+    for (unsigned int i = 0; i < entries.size(); ++i)
+    {
+        // a section past the end of the file would fault on first touch
+        const snapshot_entry& e = entries[i];
+        unsigned int namelen = strnlen(e.key_name_, SNAPSHOT_NAME);
+        if (e.key_ncolumns_ > SNAPSHOT_COLUMNS || e.offset_ % pagesize != 0
+                || namelen == SNAPSHOT_NAME || murmurhash2(e.key_name_, namelen, 0) != e.key_table_
+                || e.offset_ > size || e.length_ > size - e.offset_
+                || e.table_ % sizeof(unsigned long long) != 0 || e.table_ >= e.length_
+                || e.start_value_ > e.end_value_ || e.chunk_width_ == 0)
+        {
+            cout << "Skip bad snapshot entry "<<i<<" of "<<path<<flush<<endl;
+            continue;
+        }
+        // private mapping: swizzling the pointers must not touch the file
+        void* addr = mmap(NULL, entries[i].length_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                fd, entries[i].offset_);
+        if (addr == MAP_FAILED)
+        {
+            cout << "Cannot map hashtable["<<entries[i].start_value_<<","<<entries[i].end_value_<<"]"<<flush<<endl;
+            continue;
+        }
+        ht_node* node = new ht_node();
+        node->bloom_ = new BloomFilter();
+        node->hashtable_ = new HashTable();
+        if (!node->bloom_->attach((char*)addr, entries[i].table_)
+                || !node->hashtable_->attach((char*)addr + entries[i].table_, entries[i].length_ - entries[i].table_))
+        {
+            cout << "Skip bad snapshot entry "<<i<<" of "<<path<<flush<<endl;
+            delete node->bloom_;
+            delete node->hashtable_;
+            delete node;
+            munmap(addr, entries[i].length_);
+            continue;
+        }
+        node->key_.table_ = entries[i].key_table_;
+        node->key_.name_ = entries[i].key_name_;
+        node->key_.jattr_ = entries[i].key_jattr_;
+        node->key_.store_ = entries[i].key_store_;
+        node->key_.columns_.assign(entries[i].key_columns_, entries[i].key_columns_ + entries[i].key_ncolumns_);
+        node->set_ranges(IntervalSet(entries[i].start_value_, entries[i].end_value_));
+        node->published_ = true;
+        node->map_addr_ = addr;
+        node->map_len_ = entries[i].length_;
+        node->chunk_width_ = entries[i].chunk_width_;
+        nodes.push_back(node);
+    }
+    // the mappings keep the file alive
+    close(fd);
+    return true;
+}
 
+unsigned int ReuseCache::save(const char* path)
+{
+    epoch_.enter();
+    vector<ht_node*> nodes;
+    for (ht_node* node = cache_head_; node != NULL; node = node->next_)
+    {
+        // row ids only mean something while the build table is loaded,
+        // and an entry records a single key range and no filter
+        if (!node->dead_ && node->key_.columns_.size() <= SNAPSHOT_COLUMNS
+                && node->key_.name_.size() < SNAPSHOT_NAME
+                && node->key_.store_ == cache_key::STORE_COPY && node->ranges_.size() == 1
+                && node->key_.filter_.empty())
+        {
+            nodes.push_back(node);
+        }
+    }
+    bool ok = write_snapshot(path, nodes);
+    epoch_.exit();
+    if (!ok)
+    {
+        return 0;
+    }
+    cout << "Saved "<<nodes.size()<<" hashtables to "<<path<<flush<<endl;
+    return nodes.size();
+}
 
+unsigned int ReuseCache::load(const char* path)
+{
+    vector<ht_node*> nodes;
+    if (!map_snapshot(path, nodes))
+    {
+        return 0;
+    }
+    for (unsigned int i = 0; i < nodes.size(); ++i)
+    {
+        push(nodes[i]);
+        __sync_fetch_and_add(&curr_cache_size_, nodes[i]->end_value_ - nodes[i]->start_value_);
+        link_bytes(nodes[i]);
+    }
+    cout << "Loaded "<<nodes.size()<<" hashtables from "<<path<<flush<<endl;
+    return nodes.size();
+}
 
+void ReuseCache::set_spill(const char* dir, unsigned long long max_bytes)
+{
+    spill_dir_ = dir;
+    max_spill_size_ = max_bytes;
+}
 
+void ReuseCache::spill(ht_node* node)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/spill-%llu-%llu-%u.snap", node->start_value_, node->end_value_,
+            __sync_fetch_and_add(&spill_seq_, 1));
+    spilled_node desc;
+    desc.key_ = node->key_;
+    desc.ranges_ = node->ranges_;
+    desc.path_ = spill_dir_ + name;
+    desc.size_ = node->hashtable_->get_image_size() + node->bloom_->get_image_size();
 
+    vector<ht_node*> nodes(1, node);
+    if (desc.size_ > max_spill_size_ || desc.key_.columns_.size() > SNAPSHOT_COLUMNS
+            || desc.key_.name_.size() >= SNAPSHOT_NAME
+            || !write_snapshot(desc.path_.c_str(), nodes))
+    {
+        return;
+    }
+    __sync_fetch_and_add(&stats_.spills_, 1);
+    cout << "Spill HashTable:["<<node->start_value_<<","<<node->end_value_<<"] to "<<desc.path_<<flush<<endl;
 
+    spill_lock_.lock();
+    spilled_.push_front(desc);
+    curr_spill_size_ += desc.size_;
+    // least recently evicted first
+    while (curr_spill_size_ > max_spill_size_)
+    {
+        spilled_node& victim = spilled_.back();
+        unlink(victim.path_.c_str());
+        curr_spill_size_ -= victim.size_;
+        spilled_.pop_back();
+    }
+    spill_lock_.unlock();
+}
 
+ht_node* ReuseCache::fault_in(const cache_key& key, const IntervalSet& want, double& ratio)
+{
+    double found = ratio;
+    spill_lock_.lock();
+    list<spilled_node>::iterator best = spilled_.end();
+    for (list<spilled_node>::iterator it = spilled_.begin(); it != spilled_.end(); ++it)
+    {
+        if (!it->key_.covers(key))
+        {
+            continue;
+        }
+        double tmp_ratio = overlap_ratio(key, want, it->ranges_);
+        if (tmp_ratio >= REUSE_RATIO_ && tmp_ratio > found)
+        {
+            best = it;
+            found = tmp_ratio;
+        }
+    }
+    if (best == spilled_.end())
+    {
+        spill_lock_.unlock();
+        return NULL;
+    }
+    spilled_node desc = *best;
+    spilled_.erase(best);
+    curr_spill_size_ -= desc.size_;
+    spill_lock_.unlock();
+
+    vector<ht_node*> nodes;
+    map_snapshot(desc.path_.c_str(), nodes);
+    // mapped already, the file is not needed any more
+    unlink(desc.path_.c_str());
+    if (nodes.size() != 1)
+    {
+        // a damaged file, the node is lost
+        for (unsigned int i = 0; i < nodes.size(); ++i)
+        {
+            free_node(nodes[i]);
+        }
+        return NULL;
+    }
+    ratio = found;
+    __sync_fetch_and_add(&stats_.faults_, 1);
+    // the file records the hull only, and no filter
+    nodes[0]->set_ranges(desc.ranges_);
+    nodes[0]->key_ = desc.key_;
+    cout << "Fault in HashTable:["<<nodes[0]->start_value_<<","<<nodes[0]->end_value_<<"] from "<<desc.path_<<flush<<endl;
+    push(nodes[0]);
+    __sync_fetch_and_add(&curr_cache_size_, nodes[0]->end_value_ - nodes[0]->start_value_);
+    link_bytes(nodes[0]);
+    return nodes[0];
+}
+
+void ReuseCache::set_freeze(unsigned long long max_bytes)
+{
+    max_frozen_size_ = max_bytes;
+}
 
+void ReuseCache::freeze(ht_node* node)
+{
+    frozen_node frozen;
+    frozen.key_ = node->key_;
+    frozen.ranges_ = node->ranges_;
+    frozen.chunk_width_ = node->chunk_width_;
+    frozen.raw_size_ = node->hashtable_->get_size() + node->bloom_->get_size();
+    frozen.table_ = new FrozenTable();
+    frozen.table_->freeze(node->hashtable_);
+    __sync_fetch_and_add(&stats_.freezes_, 1);
+    cout << "Freeze HashTable:["<<node->start_value_<<","<<node->end_value_<<"] "
+         <<frozen.raw_size_<<" bytes to "<<frozen.table_->get_size()<<flush<<endl;
 
+    frozen_lock_.lock();
+    frozen_.push_front(frozen);
+    curr_frozen_size_ += frozen.table_->get_size();
+    frozen_raw_size_ += frozen.raw_size_;
+    // squeeze the coldest nodes harder before giving any up
+    for (list<frozen_node>::reverse_iterator it = frozen_.rbegin();
+            it != frozen_.rend() && curr_frozen_size_ > max_frozen_size_; ++it)
+    {
+        unsigned long long before = it->table_->get_size();
+        if (it->table_->deep_freeze())
+        {
+            curr_frozen_size_ -= before - it->table_->get_size();
+            __sync_fetch_and_add(&stats_.deep_freezes_, 1);
+        }
+    }
+    while (curr_frozen_size_ > max_frozen_size_)
+    {
+        frozen_node& victim = frozen_.back();
+        curr_frozen_size_ -= victim.table_->get_size();
+        frozen_raw_size_ -= victim.raw_size_;
+        victim.table_->destroy();
+        delete victim.table_;
+        frozen_.pop_back();
+    }
+    frozen_lock_.unlock();
+}
 
+ht_node* ReuseCache::thaw(const cache_key& key, const IntervalSet& want, double& ratio)
+{
+    double found = ratio;
+    frozen_lock_.lock();
+    list<frozen_node>::iterator best = frozen_.end();
+    for (list<frozen_node>::iterator it = frozen_.begin(); it != frozen_.end(); ++it)
+    {
+        if (!it->key_.covers(key))
+        {
+            continue;
+        }
+        double tmp_ratio = overlap_ratio(key, want, it->ranges_);
+        if (tmp_ratio >= REUSE_RATIO_ && tmp_ratio > found)
+        {
+            best = it;
+            found = tmp_ratio;
+        }
+    }
+    if (best == frozen_.end())
+    {
+        frozen_lock_.unlock();
+        return NULL;
+    }
+    frozen_node frozen = *best;
+    frozen_.erase(best);
+    curr_frozen_size_ -= frozen.table_->get_size();
+    frozen_raw_size_ -= frozen.raw_size_;
+    frozen_lock_.unlock();
 
+    ht_node* node = new ht_node();
+    node->hashtable_ = new HashTable();
+    node->bloom_ = new BloomFilter();
+    bool ok = frozen.table_->thaw(node->hashtable_, node->bloom_);
+    frozen.table_->destroy();
+    delete frozen.table_;
+    if (!ok)
+    {
+        // a damaged stream, the node is lost
+        cout << "Cannot thaw HashTable:["<<frozen.ranges_.lo()<<","<<frozen.ranges_.hi()<<"]"<<flush<<endl;
+        delete node->hashtable_;
+        delete node->bloom_;
+        delete node;
+        return NULL;
+    }
+    ratio = found;
+    node->key_ = frozen.key_;
+    node->set_ranges(frozen.ranges_);
+    node->published_ = true;
+    node->chunk_width_ = frozen.chunk_width_;
+    __sync_fetch_and_add(&stats_.thaws_, 1);
+    cout << "Thaw HashTable:["<<node->start_value_<<","<<node->end_value_<<"]"<<flush<<endl;
+    push(node);
+    __sync_fetch_and_add(&curr_cache_size_, node->end_value_ - node->start_value_);
+    link_bytes(node);
+    return node;
+}
 
+double ReuseCache::get_capacity_gain()
+{
+    unsigned long long live = get_bytes();
+    frozen_lock_.lock();
+    unsigned long long raw = frozen_raw_size_;
+    unsigned long long frozen = curr_frozen_size_;
+    frozen_lock_.unlock();
+    return live + frozen ? (double)(live + raw) / (live + frozen) : 1;
+}
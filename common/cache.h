@@ -19,47 +19,587 @@
 #define CACHE_H
 
 #include "../algo/hashtable.h"
+#include "../algo/bloomfilter.h"
+#include "../algo/frozentable.h"
+#include "stats.h"
+#include "intervals.h"
+#include "filter.h"
+#include "epoch.h"
+#include "lock.h"
+#include <cstring>
 #include <iostream>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * What a cached table was built from, besides its key range: the build
+ * table, the join attribute, how entries store the build tuple, the
+ * columns every entry carries after the join key, in entry order, and
+ * the filter on other build columns the table was built under.
+ */
+struct cache_key
+{
+    /// how entries store the build tuple, a lookup may accept both
+    enum
+    {
+        STORE_COPY = 1,     ///< the projected columns, see StoreCopy
+        STORE_ROWIDS = 2    ///< a row id, see StorePointer
+    };
+
+    cache_key() : table_(0), jattr_(0), store_(STORE_COPY) { }
+    cache_key(const std::string& table, unsigned int jattr, const std::vector<unsigned int>& columns,
+            unsigned int store = STORE_COPY);
+
+    /**
+     * True if a table built for this key can serve queries for \a want:
+     * same table and join attribute, a store \a want accepts, every
+     * column \a want projects, and a filter that subsumes that of
+     * \a want. The probe applies the rest of the filter of \a want, see
+     * BuildFilter::residual().
+     */
+    bool covers(const cache_key& want) const;
+
+    bool operator==(const cache_key& other) const
+    {
+        return table_ == other.table_ && jattr_ == other.jattr_ && store_ == other.store_
+            && name_ == other.name_ && columns_ == other.columns_ && filter_ == other.filter_;
+    }
+
+    unsigned int table_;    ///< hash of name_, stable across runs, compared first
+    std::string name_;      ///< the table name
+    unsigned int jattr_;
+    unsigned int store_;
+    std::vector<unsigned int> columns_;
+    BuildFilter filter_;
+};
 
 struct ht_node
 {
-    unsigned long long start_value_;
-    unsigned long long end_value_;
+    /** An empty unpinned node, neither published nor mapped, see ReuseCache::insert(). */
+    ht_node()
+        : start_value_(0), end_value_(0), hashtable_(NULL), bloom_(NULL), next_(NULL),
+          refs_(0), dead_(false), init_(false), published_(false), transient_(false),
+          origin_(NULL), base_tuples_(0), map_addr_(NULL), map_len_(0), retired_next_(NULL),
+          bytes_(0), chunk_width_(1), overlap_sum_(0), reuses_(0)
+    {
+    }
+
+    cache_key key_;
+    IntervalSet ranges_;    ///< keys the table holds, see set_ranges()
+    unsigned long long start_value_;    ///< smallest key of ranges_
+    unsigned long long end_value_;      ///< largest key of ranges_
     HashTable* hashtable_;
-    ht_node* next_;
+    BloomFilter* volatile bloom_;   ///< keys of hashtable_, checked before the buckets, see ReuseCache::refresh_filter()
+    ht_node* volatile next_;
+    volatile unsigned int refs_;    ///< queries using this node, see ReuseCache::release()
+    volatile bool dead_;    ///< unlinked or about to be, refuses new pins
     bool init_;
+    bool published_;        ///< linked into the cache, see ReuseCache::publish()
+    bool transient_;        ///< not admitted, freed by ReuseCache::release()
+    ht_node* origin_;       ///< published node this draft extends, pinned until publish
+    unsigned long long base_tuples_;    ///< tuples copied from origin_, see ReuseCache::record_build()
+    void* map_addr_;        ///< snapshot section the node lives in, see ReuseCache::load()
+    unsigned long long map_len_;
+    ht_node* retired_next_; ///< link in ReuseCache::retired_, readers may still follow next_
+    unsigned long long bytes_;  ///< memory of the table and filter, 0 until counted
+
+    /// queries that touched each chunk of chunk_width_ keys, by key / chunk_width_
+    std::map<unsigned long long, unsigned long long> access_;
+    unsigned long long chunk_width_;
+    double overlap_sum_;            ///< overlap ratios of the lookups that reused it
+    unsigned long long reuses_;
+    Lock access_lock_;              ///< guards access_, overlap_sum_ and reuses_
+
+    /** Sets the keys the table holds, start_value_ and end_value_ follow. */
+    void set_ranges(const IntervalSet& ranges)
+    {
+        ranges_ = ranges;
+        start_value_ = ranges.lo();
+        end_value_ = ranges.hi();
+    }
+
+    /** Queries that touched chunk \a chunk, without adding it to access_. */
+    unsigned long long accesses(unsigned long long chunk) const
+    {
+        std::map<unsigned long long, unsigned long long>::const_iterator c = access_.find(chunk);
+        return c == access_.end() ? 0 : c->second;
+    }
 };
 
+/**
+ * Counters of a ReuseCache since it was created. All of them are updated
+ * atomically, a copy may be slightly inconsistent while queries run.
+ */
+struct cache_stats
+{
+    unsigned long long hits_;           ///< lookups covered by a node as is
+    unsigned long long partial_hits_;   ///< lookups that extended a node
+    unsigned long long misses_;
+    unsigned long long rejected_;       ///< misses not admitted, see ReuseCache::admit()
+    unsigned long long evictions_;
+    unsigned long long merges_;
+    unsigned long long trims_;
+    unsigned long long extended_tuples_;    ///< tuples built into partial hits
+    unsigned long long built_tuples_;       ///< tuples built by all queries
+    unsigned long long build_cycles_;       ///< cycles spent building them
+    unsigned long long reused_tuples_;      ///< estimated tuples served from the cache
+    unsigned long long overlap_[10];    ///< best overlap ratio of each lookup, by tenths
+    unsigned long long spills_;         ///< evicted nodes written to the disk tier
+    unsigned long long faults_;         ///< lookups served by mapping a spilled node back
+    unsigned long long freezes_;        ///< evicted nodes compressed into the frozen tier
+    unsigned long long deep_freezes_;   ///< frozen nodes compressed further with bzip2
+    unsigned long long thaws_;          ///< lookups served by rebuilding a frozen node
+};
+
+/**
+ * Cache of join hash tables, shared by concurrent queries.
+ *
+ * Lookups walk the list without locking inside an epoch, see EpochManager,
+ * and pin the node they return. Everything that unlinks nodes (compact,
+ * trim, eviction, publish) holds writer_lock_; unlinked nodes are freed once
+ * they are unpinned and no lookup can still be walking over them.
+ *
+ * Published nodes are never written to. A query that needs keys outside a
+ * cached range gets a draft copy, builds the gap into it, and publish()
+ * swaps the draft in for the original in one step. The draft shares the
+ * hash table segments it does not write with the original, see
+ * HashTable::clone(). Queries still probing the original keep a consistent
+ * table for its old range.
+ */
+
 class ReuseCache
 {
     public:
         ReuseCache(unsigned long long max_cache_size)
-            : max_cache_size_(max_cache_size)
+            : max_cache_size_(max_cache_size), max_cache_bytes_(0), shared_bytes_(0)
         {
             cache_head_ = NULL;
+            retired_ = NULL;
             curr_cache_size_ = 0;
+            curr_cache_bytes_ = 0;
+            nghosts_ = 0;
+            next_ghost_ = 0;
+            max_spill_size_ = 0;
+            curr_spill_size_ = 0;
+            spill_seq_ = 0;
+            max_frozen_size_ = 0;
+            curr_frozen_size_ = 0;
+            frozen_raw_size_ = 0;
+            memset(&stats_, 0, sizeof(stats_));
         }
 
+        /**
+         * Returns a new draft for the keys \a want of \a key. Ranges that are not admitted,
+         * see admit(), get a transient node that publish() leaves alone and
+         * release() frees after the probe. \a tuplesize is that of an
+         * entry starting with its \a keysize bytes wide join key. Wider
+         * keys than 32 bits are stored as 32-bit offsets from the smallest
+         * key of \a want when they can, see HashTable::set_key_base(). The
+         * node holds no keys until built.
+         * Unless \a account is set, as for speculative builds, the range
+         * is neither counted as accessed nor remembered as a ghost.
+         */
         ht_node* insert(
-           unsigned long long start,
-           unsigned long long end,
+           const cache_key& key,
+           const IntervalSet& want,
            unsigned int bucksize,
-           unsigned int tuplesize);
+           unsigned int tuplesize,
+           unsigned int keysize,
+           bool account = true);
+
+        /**
+         * Returns the cached node that best covers the keys \a want, or NULL.
+         * Only nodes whose key covers \a key qualify, so their entries may
+         * carry more columns than asked for, see cache_key::covers(). If
+         * the node does not hold all of \a want, a draft copy of it is
+         * returned instead, for the build to fill in the missing intervals.
+         * Both this and insert() pin the returned node until release().
+         * With \a account unset the lookup leaves the access counts, which
+         * drive eviction and trimming, and the hit statistics alone.
+         */
+        ht_node* get_reusable_ht(const cache_key& key, const IntervalSet& want, bool account = true);
 
-        ht_node* get_reusable_ht(unsigned long long start, unsigned long long end);
+        /**
+         * Makes a built draft visible to other queries. A draft from insert()
+         * is pushed on the list, a draft from get_reusable_ht() replaces the
+         * node it was copied from. Transient drafts stay unlinked. Either
+         * way the filter is resized first, see refresh_filter(). Does
+         * nothing for published nodes.
+         */
+        void publish(ht_node* node);
+
+        /**
+         * Unpins \a node once the query has finished probing it. A draft
+         * that was never published is freed.
+         */
+        void release(ht_node* node);
+
+        /**
+         * Merges every pair of overlapping nodes into one table. The larger
+         * table is copied as is and only the keys of the smaller node that
+         * fall outside it are rehashed. The old nodes are retired and freed
+         * once no query pins them any more.
+         */
+        void compact();
 
         void add_cache(unsigned long long addtional_cache);
 
         void destroy();
 
-        void garbage_collection(); ///< LRU algorithm.
+        /**
+         * Brings the cache back under its budget. Cold key ranges at either
+         * end of a table are trimmed first, then whole nodes are evicted,
+         * both in ascending order of keep_score(), older nodes first among
+         * equals. Pinned nodes are skipped, like compact() and trim() do.
+         */
+        void garbage_collection();
+
+        /**
+         * Caps the memory of the cached tables and filters at \a max_bytes
+         * on top of the key range budget, 0 lifts the cap. Lowering it
+         * takes effect at the next garbage_collection().
+         */
+        inline void set_max_bytes(unsigned long long max_bytes)
+        {
+            max_cache_bytes_ = max_bytes;
+        }
+
+        inline unsigned long long get_max_bytes()
+        {
+            return max_cache_bytes_;
+        }
+
+        /** Bytes held by the cached tables and filters. */
+        inline unsigned long long get_bytes()
+        {
+            return curr_cache_bytes_;
+        }
+
+        /** Bytes held by the compressed tables of the frozen tier. */
+        inline unsigned long long get_frozen_bytes()
+        {
+            return curr_frozen_size_;
+        }
+
+        /**
+         * Bytes counted against the byte budget: the cached tables and
+         * filters, the frozen tier and the shared bytes.
+         */
+        inline unsigned long long get_used_bytes()
+        {
+            return curr_cache_bytes_ + curr_frozen_size_ + shared_bytes_;
+        }
+
+        /**
+         * Counts \a bytes held elsewhere under the same byte budget, see
+         * ResultCache. The cached tables get what they leave.
+         */
+        inline void set_shared_bytes(unsigned long long bytes)
+        {
+            shared_bytes_ = bytes;
+        }
+
+        /**
+         * Registers the statistics of the join column of the tables of
+         * \a key, which size new hash tables and weigh range overlaps by
+         * the tuples they hold. Set them before the first query.
+         */
+        void set_stats(const cache_key& key, const ColumnStats* stats);
+
+        /**
+         * Drops the cold prefix and suffix chunks of the node at \a link.
+         * A chunk is cold when it was accessed less than 1/COLD_RATIO_
+         * times as often as the hottest chunk of the node. Returns true if
+         * the node was replaced by a trimmed copy. Caller holds writer_lock_.
+         */
+        bool trim(ht_node** link);
 
         void print_cache();
 
+        /**
+         * Reports the build of \a node that took \a cycles, so the stats
+         * know the tuples built per extension and the cost of a tuple.
+         * Call before publish().
+         */
+        void record_build(ht_node* node, unsigned long long cycles);
+
+        inline cache_stats get_stats()
+        {
+            return stats_;
+        }
+
+        /**
+         * Build cycles saved by reuse: the tuples served from the cache
+         * times the average cost of building one.
+         */
+        unsigned long long get_build_cycles_saved();
+
+        /**
+         * Writes the counters and one row per cached node (range, tuples,
+         * bytes, average chain length, access count, Bloom filter false
+         * positive rate, average overlap ratio of the lookups that reused
+         * it) as CSV. The first column tells the two kinds of rows apart.
+         */
+        void dump_csv(std::ostream& out);
+
+        /** Same as dump_csv(), as one JSON object on one line. */
+        void dump_json(std::ostream& out);
+
+        /**
+         * Writes every cached node to the snapshot file \a path and returns
+         * how many were written. Each node gets its own page-aligned section
+         * holding its Bloom filter and hash table images, see
+         * HashTable::serialize(). Entries are copied byte by byte, so only
+         * tables of position-independent entries (StoreCopy) can be saved.
+         */
+        unsigned int save(const char* path);
+
+        /**
+         * Maps the sections of the snapshot file \a path with mmap and
+         * links them in as cached nodes, usable without rebuilding. Returns
+         * the number of nodes loaded, 0 if there is no usable snapshot.
+         */
+        unsigned int load(const char* path);
+
+        /**
+         * Enables the disk tier: evicted nodes are written to \a dir as
+         * one-node snapshots and mapped back on a later reusable lookup.
+         * The tier holds at most \a max_bytes and drops the least recently
+         * evicted nodes first.
+         */
+        void set_spill(const char* dir, unsigned long long max_bytes);
+
+        /**
+         * Enables the frozen tier: evicted nodes are kept compressed in
+         * memory, see FrozenTable, up to \a max_bytes, and rebuilt on a
+         * later reusable lookup. Over budget, the least recently frozen
+         * nodes are compressed further with bzip2, then dropped. Takes
+         * precedence over the disk tier.
+         */
+        void set_freeze(unsigned long long max_bytes);
+
+        /**
+         * How many more bytes of probe-ready tables the cache holds thanks
+         * to the frozen tier: (live + uncompressed frozen) / (live + frozen).
+         */
+        double get_capacity_gain();
+
     private:
-        ht_node* cache_head_;
+        struct ghost
+        {
+            IntervalSet ranges_;    ///< keys of the rejected miss
+        };
+
+        /**
+         * Fraction of the union of both key sets that \a want covers, 0 if
+         * they do not overlap. Counted in tuples if the column of \a key
+         * has statistics and in keys otherwise.
+         */
+        double overlap_ratio(const cache_key& key, const IntervalSet& want, const IntervalSet& other);
+
+        /** Statistics of the join column of \a key, NULL if none were set. */
+        const ColumnStats* find_stats(const cache_key& key);
+
+        /**
+         * Estimated build tuples of \a key in \a keys, the number of keys if
+         * the column has no statistics.
+         */
+        double estimate_rows(const cache_key& key, const IntervalSet& keys);
+
+        /**
+         * Admission policy. A range is admitted when it fits in the free
+         * budget, keys and \a bytes, the estimated size of its table and
+         * filter, or when the ghosts of earlier misses predict enough
+         * reuse: their overlap ratios with \a want add up to
+         * ADMIT_BENEFIT_. A rejected range is remembered as a ghost if
+         * \a account is set. The key budget counts the smallest range that
+         * holds all of \a want.
+         */
+        bool admit(const cache_key& key, const IntervalSet& want, unsigned long long bytes, bool account);
+
+        ht_node* merge(ht_node* large, ht_node* small);
+
+        /** Writes \a nodes as a snapshot file, see save(). */
+        bool write_snapshot(const char* path, const std::vector<ht_node*>& nodes);
+
+        /**
+         * Maps the nodes of a snapshot file and appends them to \a nodes.
+         * Entries that do not fit in the file or whose images are
+         * inconsistent are skipped.
+         */
+        bool map_snapshot(const char* path, std::vector<ht_node*>& nodes);
+
+        /** Writes an evicted node to the disk tier, if it is enabled. */
+        void spill(ht_node* node);
+
+        /**
+         * Maps back the spilled node of \a key that best covers \a want if its
+         * overlap ratio beats \a ratio and the reuse threshold, links it in
+         * and returns it. \a ratio is updated only then; a file that
+         * cannot be mapped back is dropped.
+         */
+        ht_node* fault_in(const cache_key& key, const IntervalSet& want, double& ratio);
+
+        /**
+         * True if \a a and \a b have entries of one layout and one table
+         * can hold the keys of both, see HashTable::fits().
+         */
+        bool mergeable(ht_node* a, ht_node* b);
+
+        /** Bytes of a published \a node, counted once. */
+        unsigned long long node_bytes(ht_node* node);
+
+        /**
+         * Worth of keeping \a node per byte: the tuples of its ranges,
+         * estimated from the column statistics, which each reuse saves
+         * building, times one more than its reuses so far.
+         */
+        double keep_score(ht_node* node);
+
+        /**
+         * Linked nodes, the least worth keeping first, see keep_score().
+         * Caller holds writer_lock_.
+         */
+        std::vector<ht_node*> eviction_order();
+
+        /** The link pointing at the linked \a node. Caller holds writer_lock_. */
+        ht_node** link_of(ht_node* node);
+
+        /** Counts \a node, just linked in, under the byte budget. */
+        inline void link_bytes(ht_node* node)
+        {
+            __sync_fetch_and_add(&curr_cache_bytes_, node_bytes(node));
+        }
+
+        /** Stops counting \a node, just unlinked. */
+        inline void unlink_bytes(ht_node* node)
+        {
+            __sync_fetch_and_sub(&curr_cache_bytes_, node_bytes(node));
+        }
+
+        /** True if the cache holds more keys or bytes than allowed. */
+        bool over_budget();
+
+        /** Compresses an evicted node into the frozen tier. */
+        void freeze(ht_node* node);
+
+        /** Like fault_in(), for the frozen tier. */
+        ht_node* thaw(const cache_key& key, const IntervalSet& want, double& ratio);
+
+        /** Adds the best overlap \a ratio of a lookup to the histogram. */
+        void record_overlap(double ratio);
+
+        /**
+         * Copy of the pinned \a origin, to be extended and published. Its
+         * table copies the segments of \a origin on the first write only.
+         */
+        ht_node* draft(ht_node* origin);
+
+        /** Links \a node in at the head of the list. */
+        void push(ht_node* node);
+
+        /** Counts an access of [start, end] on the chunks of \a node. */
+        void touch(ht_node* node, unsigned long long start, unsigned long long end);
+
+        /** Counts a lookup that reused \a node with the overlap \a ratio. */
+        void record_reuse(ht_node* node, double ratio);
+
+        /**
+         * Pins \a node for the calling query. Fails if a writer has claimed
+         * the node, see seize().
+         */
+        bool pin(ht_node* node);
+
+        /**
+         * Claims an unpinned node so no query can pin it any more.
+         * Together with pin() this is a Dekker handshake on refs_ and dead_.
+         */
+        bool seize(ht_node* node);
+
+        /**
+         * Points \a link, which holds \a node, at \a repl instead. Returns
+         * the link actually updated, insert() may have pushed new heads.
+         */
+        ht_node** replace(ht_node** link, ht_node* node, ht_node* repl);
+
+        /** Unlinked nodes wait here until the last query releases them. */
+        void retire(ht_node* node);
+
+        /** Hands retired, unpinned nodes to the epoch manager. */
+        void reclaim();
+
+        static void free_node(void* node);
+
+        /**
+         * Rebuilds the Bloom filter of the unpublished \a node when its
+         * ranges hold more distinct keys than the filter was sized for,
+         * by the column statistics if set and never more than its tuples.
+         * The new filter is filled on the side and swapped in, the old one
+         * goes to the epoch manager.
+         */
+        void refresh_filter(ht_node* node);
+
+        static void free_filter(void* bloom);
+
+        ht_node* volatile cache_head_;
+        ht_node* retired_;  ///< unlinked nodes, possibly still pinned
+        Lock writer_lock_;  ///< serializes compact(), trim() and eviction
+        EpochManager epoch_;
+        cache_stats stats_;
         unsigned long long  max_cache_size_;
         unsigned long long  curr_cache_size_;
+        volatile unsigned long long curr_cache_bytes_;  ///< of the linked nodes, see link_bytes()
+        unsigned long long  max_cache_bytes_;     ///< 0 if only keys are counted
+        volatile unsigned long long shared_bytes_;  ///< see set_shared_bytes()
+
+        static const unsigned int CHUNKS_PER_NODE_ = 16;
+        static const unsigned int COLD_RATIO_ = 4;
+        static const unsigned int MAX_GHOSTS_ = 64;
+        static const double REUSE_RATIO_;
+        static const double ADMIT_BENEFIT_;
+
+        /// ranges of recent misses that were not admitted, a ring buffer
+        ghost ghosts_[MAX_GHOSTS_];
+        unsigned int nghosts_;
+        unsigned int next_ghost_;
+        Lock ghost_lock_;
+
+        /// join column statistics by table name and join attribute, see set_stats()
+        std::map<std::pair<std::string, unsigned int>, const ColumnStats*> column_stats_;
+
+        /** Descriptor of a node in the disk tier. */
+        struct spilled_node
+        {
+            cache_key key_;
+            IntervalSet ranges_;
+            std::string path_;
+            unsigned long long size_;   ///< bytes of the file
+        };
+
+        std::string spill_dir_;
+        std::list<spilled_node> spilled_;   ///< most recently evicted first
+        unsigned long long max_spill_size_; ///< bytes, 0 disables the tier
+        unsigned long long curr_spill_size_;
+        unsigned int spill_seq_;
+        Lock spill_lock_;
+
+        /** A node of the frozen tier. */
+        struct frozen_node
+        {
+            cache_key key_;
+            IntervalSet ranges_;
+            unsigned long long chunk_width_;
+            unsigned long long raw_size_;   ///< bytes of the table and filter it came from
+            FrozenTable* table_;
+        };
+
+        std::list<frozen_node> frozen_;     ///< most recently frozen first
+        unsigned long long max_frozen_size_;    ///< bytes, 0 disables the tier
+        volatile unsigned long long curr_frozen_size_;  ///< read without frozen_lock_ by get_used_bytes()
+        unsigned long long frozen_raw_size_;
+        Lock frozen_lock_;
 
 };
 
@@ -0,0 +1,140 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "epoch.h"
+#include "exceptions.h"
+
+static __thread int myslot = -1;
+
+volatile unsigned int EpochManager::taken_[MAX_THREADS_];
+pthread_key_t EpochManager::slot_key_;
+pthread_once_t EpochManager::slot_once_ = PTHREAD_ONCE_INIT;
+
+void EpochManager::create_key()
+{
+    pthread_key_create(&slot_key_, release_slot);
+}
+
+void EpochManager::release_slot(void* slot)
+{
+    // the thread is gone, so it left every epoch already
+    __sync_synchronize();
+    taken_[(unsigned long)slot - 1] = 0;
+}
+
+unsigned int EpochManager::thread_slot()
+{
+    if (myslot < 0)
+    {
+        pthread_once(&slot_once_, create_key);
+        unsigned int s = 0;
+        while (s < MAX_THREADS_ && !__sync_bool_compare_and_swap(&taken_[s], 0, 1))
+            ++s;
+        if (s >= MAX_THREADS_)
+            throw TooManyThreadsException();
+        pthread_setspecific(slot_key_, (void*)(unsigned long)(s + 1));
+        myslot = s;
+    }
+    return myslot;
+}
+
+EpochManager::EpochManager()
+    : epoch_(0), garbage_(0)
+{
+    for (unsigned int i = 0; i < MAX_THREADS_; ++i)
+        slots_[i].epoch_ = IDLE_;
+}
+
+void EpochManager::enter()
+{
+    slots_[thread_slot()].epoch_ = epoch_;
+    // the announcement must be visible before the first shared read
+    __sync_synchronize();
+}
+
+void EpochManager::exit()
+{
+    __sync_synchronize();
+    slots_[thread_slot()].epoch_ = IDLE_;
+}
+
+void EpochManager::retire(void* obj, free_fn fn)
+{
+    Garbage* g = new Garbage();
+    g->obj_ = obj;
+    g->fn_ = fn;
+    garbage_lock_.lock();
+    g->epoch_ = epoch_;
+    g->next_ = garbage_;
+    garbage_ = g;
+    garbage_lock_.unlock();
+}
+
+void EpochManager::reclaim()
+{
+    __sync_fetch_and_add(&epoch_, 1);
+
+    unsigned long long oldest = IDLE_;
+    for (unsigned int i = 0; i < MAX_THREADS_; ++i)
+    {
+        unsigned long long e = slots_[i].epoch_;
+        oldest = e < oldest ? e : oldest;
+    }
+
+    // readers that entered at or after the retire epoch may still hold it
+    Garbage* ready = 0;
+    garbage_lock_.lock();
+    Garbage** link = &garbage_;
+    while (*link)
+    {
+        Garbage* g = *link;
+        if (g->epoch_ < oldest)
+        {
+            *link = g->next_;
+            g->next_ = ready;
+            ready = g;
+        }
+        else
+        {
+            link = &g->next_;
+        }
+    }
+    garbage_lock_.unlock();
+
+    while (ready)
+    {
+        Garbage* g = ready;
+        ready = g->next_;
+        g->fn_(g->obj_);
+        delete g;
+    }
+}
+
+void EpochManager::destroy()
+{
+    garbage_lock_.lock();
+    Garbage* g = garbage_;
+    garbage_ = 0;
+    garbage_lock_.unlock();
+    while (g)
+    {
+        Garbage* next = g->next_;
+        g->fn_(g->obj_);
+        delete g;
+        g = next;
+    }
+}
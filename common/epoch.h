@@ -0,0 +1,91 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "lock.h"
+#include <pthread.h>
+
+/**
+ * Epoch-based reclamation. Readers bracket every access to shared objects
+ * with enter() and exit(); writers unlink an object and hand it to
+ * retire(). The object is freed by reclaim() once every thread that could
+ * still see it has left its epoch.
+ */
+class EpochManager
+{
+    public:
+        typedef void (*free_fn)(void*);
+
+        EpochManager();
+
+        /** Marks the calling thread as reading. Calls do not nest. */
+        void enter();
+        void exit();
+
+        /** Frees \a obj with \a fn once no reader can still reach it. */
+        void retire(void* obj, free_fn fn);
+
+        /** Advances the global epoch and frees what is safe to free. */
+        void reclaim();
+
+        /** Frees everything retired. Only call when no thread is reading. */
+        void destroy();
+
+    private:
+        struct Garbage
+        {
+            void* obj_;
+            free_fn fn_;
+            unsigned long long epoch_;
+            Garbage* next_;
+        };
+
+        /// one cache line per thread, so readers do not share lines
+        struct Slot
+        {
+            volatile unsigned long long epoch_;
+            char pad_[64 - sizeof(unsigned long long)];
+        };
+
+        /**
+         * Index of the calling thread, assigned on first use. Indices are
+         * shared by all managers and handed back when the thread exits,
+         * so at most MAX_THREADS_ threads may be alive at once.
+         */
+        static unsigned int thread_slot();
+
+        /** pthread key destructor, frees the slot of an exiting thread. */
+        static void release_slot(void* slot);
+
+        static void create_key();
+
+        static const unsigned int MAX_THREADS_ = 128;
+        static const unsigned long long IDLE_ = ~0ULL;
+
+        static volatile unsigned int taken_[MAX_THREADS_];   ///< 1 while a live thread owns the index
+        static pthread_key_t slot_key_;     ///< index + 1 of the thread, for release_slot()
+        static pthread_once_t slot_once_;
+
+        Slot slots_[MAX_THREADS_];
+        volatile unsigned long long epoch_;
+        Garbage* garbage_;
+        Lock garbage_lock_;
+};
+
+#endif // EPOCH_H
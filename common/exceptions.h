@@ -24,6 +24,8 @@ class IllegalSchemaDeclarationException { };
 
 class UnknownAlgorithmException { };
 
+class UnknownOutputException { };
+
 class UnknownPartitionerException { };
 
 class UnknownHashException { };
@@ -40,8 +42,12 @@ class AffinitizationException { };
 
 class FileNotFoundException { };
 
+class UnknownPageException { };
+
 class ComparisonException { };
 
 class NotYetImplemented { };
 
+class TooManyThreadsException { };
+
 #endif // EXCEPTIONS_H
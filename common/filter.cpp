@@ -0,0 +1,98 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "filter.h"
+#include "schema.h"
+
+void BuildFilter::add(unsigned int column, const IntervalSet& keys)
+{
+    unsigned int i = 0;
+    while (i < terms_.size() && terms_[i].first < column)
+    {
+        ++i;
+    }
+    if (i < terms_.size() && terms_[i].first == column)
+    {
+        terms_[i].second = terms_[i].second.intersect(keys);
+        return;
+    }
+    terms_.insert(terms_.begin() + i, make_pair(column, keys));
+}
+
+vector<unsigned int> BuildFilter::columns() const
+{
+    vector<unsigned int> ret;
+    for (unsigned int i = 0; i < terms_.size(); ++i)
+    {
+        ret.push_back(terms_[i].first);
+    }
+    return ret;
+}
+
+bool BuildFilter::subsumes(const BuildFilter& other) const
+{
+    // every term of this must be implied by a tighter term of other
+    for (unsigned int i = 0; i < terms_.size(); ++i)
+    {
+        const IntervalSet* keys = other.find(terms_[i].first);
+        if (NULL == keys || !terms_[i].second.contains(*keys))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+BuildFilter BuildFilter::residual(const BuildFilter& weaker) const
+{
+    BuildFilter ret;
+    for (unsigned int i = 0; i < terms_.size(); ++i)
+    {
+        const IntervalSet* keys = weaker.find(terms_[i].first);
+        if (NULL == keys || !terms_[i].second.contains(*keys))
+        {
+            ret.terms_.push_back(terms_[i]);
+        }
+    }
+    return ret;
+}
+
+bool BuildFilter::passes(Schema* s, void* tuple, const vector<unsigned int>& pos) const
+{
+    for (unsigned int i = 0; i < terms_.size(); ++i)
+    {
+        unsigned long long value = CT_LONG == s->get_column_type(pos[i])
+            ? s->as_long(tuple, pos[i]) : s->as_int(tuple, pos[i]);
+        if (!terms_[i].second.contains(value))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const IntervalSet* BuildFilter::find(unsigned int column) const
+{
+    for (unsigned int i = 0; i < terms_.size(); ++i)
+    {
+        if (terms_[i].first == column)
+        {
+            return &terms_[i].second;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,92 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <vector>
+#include <utility>
+#include "intervals.h"
+
+class Schema;
+
+/**
+ * Conjunction of key sets on integer columns of the build table: a tuple
+ * passes if the value of every listed column is in the set of that
+ * column. Values are compared as unsigned. Terms are kept sorted by
+ * column, one per column.
+ */
+class BuildFilter
+{
+    public:
+        /** Adds the term \a column in \a keys, intersected with an earlier one. */
+        void add(unsigned int column, const IntervalSet& keys);
+
+        inline bool empty() const
+        {
+            return terms_.empty();
+        }
+
+        inline unsigned int size() const
+        {
+            return terms_.size();
+        }
+
+        inline unsigned int get_column(unsigned int i) const
+        {
+            return terms_[i].first;
+        }
+
+        inline const IntervalSet& get_keys(unsigned int i) const
+        {
+            return terms_[i].second;
+        }
+
+        /** Columns of the terms, in order. */
+        std::vector<unsigned int> columns() const;
+
+        /**
+         * True if every tuple that passes \a other passes this filter too,
+         * so a table built under this filter holds all tuples \a other wants.
+         */
+        bool subsumes(const BuildFilter& other) const;
+
+        /**
+         * The terms of this filter that \a weaker does not imply. A tuple
+         * that passes \a weaker passes this filter if it passes them.
+         */
+        BuildFilter residual(const BuildFilter& weaker) const;
+
+        /**
+         * True if \a tuple of schema \a s passes, \a pos holding the column
+         * of \a s that has the value of each term.
+         */
+        bool passes(Schema* s, void* tuple, const std::vector<unsigned int>& pos) const;
+
+        bool operator==(const BuildFilter& other) const
+        {
+            return terms_ == other.terms_;
+        }
+
+    private:
+        /** Term of \a column, NULL if the filter has none. */
+        const IntervalSet* find(unsigned int column) const;
+
+        std::vector<std::pair<unsigned int, IntervalSet> > terms_;
+};
+
+#endif // FILTER_H
@@ -52,8 +52,8 @@ unsigned int murmurhash2(const void *key, int len, unsigned int hash)
     // Handle the last few bytes of the input array
     switch (len)
     {
-      case 3: h ^= data[2] << 16;
-      case 2: h ^= data[1] << 8;
+      case 3: h ^= data[2] << 16; // fall through
+      case 2: h ^= data[1] << 8; // fall through
       case 1: h ^= data[0];
               h *= m;
     };
@@ -67,6 +67,53 @@ unsigned int murmurhash2(const void *key, int len, unsigned int hash)
 
 }
 
+unsigned long long murmurhash64(const void *key, int len, unsigned long long hash)
+{
+    const unsigned long long m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+
+    unsigned long long h = hash ^ (len * m);
+
+    // Mix 8 bytes at a time into the hash
+    const unsigned char *data = static_cast<const unsigned char *>(key);
+    while (len >= 8)
+    {
+      unsigned long long k = 0;
+      for (int i = 7; i >= 0; --i)
+      {
+          k = (k << 8) | data[i];
+      }
+
+      k *= m;
+      k ^= k >> r;
+      k *= m;
+
+      h ^= k;
+      h *= m;
+
+      data += 8;
+      len -= 8;
+    }
+
+    // Handle the last few bytes of the input array
+    switch (len)
+    {
+      case 7: h ^= (unsigned long long)data[6] << 48; // fall through
+      case 6: h ^= (unsigned long long)data[5] << 40; // fall through
+      case 5: h ^= (unsigned long long)data[4] << 32; // fall through
+      case 4: h ^= (unsigned long long)data[3] << 24; // fall through
+      case 3: h ^= (unsigned long long)data[2] << 16; // fall through
+      case 2: h ^= (unsigned long long)data[1] << 8; // fall through
+      case 1: h ^= (unsigned long long)data[0];
+              h *= m;
+    };
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
 
 
 
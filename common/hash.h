@@ -28,4 +28,19 @@
 
 unsigned int murmurhash2(const void *key, int len, unsigned int hash);
 
+/** MurmurHash64A, the 64-bit variant of the above by the same author. */
+unsigned long long murmurhash64(const void *key, int len, unsigned long long hash);
+
+/**
+ * Hash of the join key \a key read from a column \a width bytes wide.
+ * Only those low bytes are hashed, so every path that hashes a key must
+ * agree on the width, see HashTable::set_hash_width(). 64 bits wide, the
+ * hash tables take their fingerprints and directory bits from different
+ * halves.
+ */
+inline unsigned long long hash_key(unsigned long long key, unsigned int width)
+{
+    return murmurhash64(&key, width, 0);
+}
+
 #endif // HASH_H
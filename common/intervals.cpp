@@ -0,0 +1,158 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include "intervals.h"
+
+using namespace std;
+
+void IntervalSet::add(unsigned long long lo, unsigned long long hi)
+{
+    ranges r;
+    get_ranges(r);
+    r.push_back(make_pair(lo, hi < ~0ULL - 1 ? hi : ~0ULL - 1));
+    assign(r);
+}
+
+void IntervalSet::clear()
+{
+    bounds_.assign(1, ~0ULL);
+    nbounds_ = 0;
+}
+
+unsigned long long IntervalSet::width() const
+{
+    unsigned long long w = 0;
+    for (unsigned int i = 0; i < nbounds_; i += 2)
+    {
+        w += bounds_[i + 1] - bounds_[i];
+    }
+    return w;
+}
+
+bool IntervalSet::contains(const IntervalSet& other) const
+{
+    return other.minus(*this).empty();
+}
+
+bool IntervalSet::overlaps(const IntervalSet& other) const
+{
+    return !intersect(other).empty();
+}
+
+IntervalSet IntervalSet::unite(const IntervalSet& other) const
+{
+    ranges r;
+    get_ranges(r);
+    other.get_ranges(r);
+    IntervalSet ret;
+    ret.assign(r);
+    return ret;
+}
+
+IntervalSet IntervalSet::intersect(const IntervalSet& other) const
+{
+    ranges r;
+    unsigned int i = 0, j = 0;
+    while (i < size() && j < other.size())
+    {
+        unsigned long long lo = max(get_lo(i), other.get_lo(j));
+        unsigned long long hi = min(get_hi(i), other.get_hi(j));
+        if (lo <= hi)
+        {
+            r.push_back(make_pair(lo, hi));
+        }
+        // move past the interval that ends first
+        if (get_hi(i) < other.get_hi(j))
+            ++i;
+        else
+            ++j;
+    }
+    IntervalSet ret;
+    ret.assign(r);
+    return ret;
+}
+
+IntervalSet IntervalSet::minus(const IntervalSet& other) const
+{
+    ranges r;
+    unsigned int j = 0;
+    for (unsigned int i = 0; i < size(); ++i)
+    {
+        unsigned long long lo = get_lo(i);
+        unsigned long long hi = get_hi(i);
+        while (j < other.size() && other.get_hi(j) < lo)
+        {
+            ++j;
+        }
+        // cut the pieces of other out of [lo, hi] from the left
+        unsigned int k = j;
+        while (lo <= hi && k < other.size() && other.get_lo(k) <= hi)
+        {
+            if (other.get_lo(k) > lo)
+            {
+                r.push_back(make_pair(lo, other.get_lo(k) - 1));
+            }
+            if (other.get_hi(k) >= hi)
+            {
+                lo = hi + 1;
+                break;
+            }
+            lo = other.get_hi(k) + 1;
+            ++k;
+        }
+        if (lo <= hi)
+        {
+            r.push_back(make_pair(lo, hi));
+        }
+    }
+    IntervalSet ret;
+    ret.assign(r);
+    return ret;
+}
+
+void IntervalSet::assign(ranges& r)
+{
+    sort(r.begin(), r.end());
+    bounds_.clear();
+    for (unsigned int i = 0; i < r.size(); ++i)
+    {
+        // merge with the last interval if it overlaps or touches it
+        if (!bounds_.empty() && r[i].first <= bounds_.back())
+        {
+            bounds_.back() = max(bounds_.back(), r[i].second + 1);
+            continue;
+        }
+        bounds_.push_back(r[i].first);
+        bounds_.push_back(r[i].second + 1);
+    }
+    nbounds_ = bounds_.size();
+    unsigned int padded = 1;
+    while (padded < nbounds_)
+    {
+        padded *= 2;
+    }
+    bounds_.resize(padded, ~0ULL);
+}
+
+void IntervalSet::get_ranges(ranges& r) const
+{
+    for (unsigned int i = 0; i < size(); ++i)
+    {
+        r.push_back(make_pair(get_lo(i), get_hi(i)));
+    }
+}
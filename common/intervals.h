@@ -0,0 +1,129 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INTERVALS_H
+#define INTERVALS_H
+
+#include <vector>
+#include <utility>
+
+/**
+ * A set of keys given as sorted, disjoint closed intervals, for range
+ * disjunctions and IN-lists. Keys are below ~0ULL.
+ *
+ * The intervals are kept as a flat array of bounds, the first key of
+ * every interval followed by the first key after it, padded with ~0ULL
+ * to a power of two. A key is in the set if an odd number of bounds are
+ * not greater than it, which contains() counts with a binary search of
+ * fixed depth and no data-dependent branches.
+ */
+class IntervalSet
+{
+    public:
+        IntervalSet() : bounds_(1, ~0ULL), nbounds_(0) { }
+        IntervalSet(unsigned long long lo, unsigned long long hi)
+            : bounds_(1, ~0ULL), nbounds_(0)
+        {
+            add(lo, hi);
+        }
+
+        /** Adds [lo, hi], merging it with the intervals it overlaps or touches. */
+        void add(unsigned long long lo, unsigned long long hi);
+
+        void clear();
+
+        inline bool empty() const
+        {
+            return 0 == nbounds_;
+        }
+
+        /** Number of disjoint intervals. */
+        inline unsigned int size() const
+        {
+            return nbounds_ / 2;
+        }
+
+        /** First key of interval \a i. */
+        inline unsigned long long get_lo(unsigned int i) const
+        {
+            return bounds_[2 * i];
+        }
+
+        /** Last key of interval \a i. */
+        inline unsigned long long get_hi(unsigned int i) const
+        {
+            return bounds_[2 * i + 1] - 1;
+        }
+
+        /** Smallest key of the set, 0 if empty. */
+        inline unsigned long long lo() const
+        {
+            return nbounds_ ? bounds_[0] : 0;
+        }
+
+        /** Largest key of the set, 0 if empty. */
+        inline unsigned long long hi() const
+        {
+            return nbounds_ ? bounds_[nbounds_ - 1] - 1 : 0;
+        }
+
+        /** Number of keys in the set. */
+        unsigned long long width() const;
+
+        inline bool contains(unsigned long long key) const
+        {
+            const unsigned long long* b = &bounds_[0];
+            unsigned int base = 0;
+            for (unsigned int len = bounds_.size(); len > 1; )
+            {
+                unsigned int half = len / 2;
+                base += (b[base + half - 1] <= key) * half;
+                len -= half;
+            }
+            return (base + (b[base] <= key)) & 1;
+        }
+
+        /** True if every key of \a other is in the set. */
+        bool contains(const IntervalSet& other) const;
+
+        /** True if some key is in both sets. */
+        bool overlaps(const IntervalSet& other) const;
+
+        IntervalSet unite(const IntervalSet& other) const;
+        IntervalSet intersect(const IntervalSet& other) const;
+
+        /** Keys of the set that are not in \a other. */
+        IntervalSet minus(const IntervalSet& other) const;
+
+        bool operator==(const IntervalSet& other) const
+        {
+            return nbounds_ == other.nbounds_ && bounds_ == other.bounds_;
+        }
+
+    private:
+        typedef std::vector<std::pair<unsigned long long, unsigned long long> > ranges;
+
+        /** Replaces the set by \a r, closed intervals in any order. */
+        void assign(ranges& r);
+
+        void get_ranges(ranges& r) const;
+
+        std::vector<unsigned long long> bounds_;
+        unsigned int nbounds_;  ///< bounds before the padding
+};
+
+#endif // INTERVALS_H
@@ -69,7 +69,6 @@ void Loader::load(const string &filename, WriteTable &output)
         BZFILE* b;
         int bzerror;
         int nbuf;
-        int nwritten;
 
         int unused = 0;
 
@@ -35,6 +35,12 @@ class Lock {
             }
         }
 
+        /** Takes the lock if it is free; never blocks. */
+        inline bool try_lock()
+        {
+            return !tas(&_l);
+        }
+
         /** Unlocks the lock object. */
         inline void unlock()
         {
@@ -0,0 +1,132 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "membudget.h"
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+const double MemoryBudget::PRESSURE_ = 10.0;
+
+MemoryBudget::MemoryBudget()
+    : reserved_(0)
+{
+    // a cgroup v2 entry reads "0::/path"
+    ifstream in("/proc/self/cgroup");
+    string line;
+    while (getline(in, line))
+    {
+        if (line.compare(0, 3, "0::") == 0)
+        {
+            cgroup_ = "/sys/fs/cgroup" + line.substr(3);
+            break;
+        }
+    }
+}
+
+bool MemoryBudget::read_value(const string& file, unsigned long long& value)
+{
+    ifstream in(file.c_str());
+    string word;
+    if (!(in >> word) || word == "max")
+        return false;
+    value = strtoull(word.c_str(), NULL, 10);
+    return true;
+}
+
+bool MemoryBudget::read_limits(unsigned long long& limit, unsigned long long& free)
+{
+    unsigned long long total = 0, available = 0, unused = 0;
+    ifstream in("/proc/meminfo");
+    string key;
+    unsigned long long kb;
+    while (in >> key >> kb)
+    {
+        if (key == "MemTotal:")
+            total = kb << 10;
+        else if (key == "MemAvailable:")
+            available = kb << 10;
+        else if (key == "MemFree:")
+            unused = kb << 10;
+        in.ignore(64, '\n');
+    }
+    if (0 == total)
+    {
+        // no /proc/meminfo, ask libc for the physical memory
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long avail = sysconf(_SC_AVPHYS_PAGES);
+        long pagesize = sysconf(_SC_PAGESIZE);
+        if (pages <= 0 || pagesize <= 0)
+            return false;
+        total = (unsigned long long)pages * pagesize;
+        available = avail > 0 ? (unsigned long long)avail * pagesize : total;
+    }
+    limit = total;
+    // kernels before 3.14 have no MemAvailable
+    free = available ? available : unused;
+
+    unsigned long long max, current;
+    if (!cgroup_.empty() && read_value(cgroup_ + "/memory.max", max) && max < limit)
+    {
+        limit = max;
+        if (read_value(cgroup_ + "/memory.current", current))
+        {
+            unsigned long long room = current < max ? max - current : 0;
+            free = room < free ? room : free;
+        }
+    }
+    return true;
+}
+
+unsigned long long MemoryBudget::get_budget(unsigned long long cache_bytes)
+{
+    unsigned long long limit, free;
+    if (!read_limits(limit, free))
+        return 0;
+    unsigned long long room = limit > reserved_ ? limit - reserved_ : 0;
+    // the cache is part of the used memory, it may keep what it has
+    if (cache_bytes + free < room)
+        room = cache_bytes + free;
+    room = room / CACHE_SHARE_ * (CACHE_SHARE_ - 1);
+    // 0 would lift the cap of the cache
+    return room > 0 ? room : 1;
+}
+
+bool MemoryBudget::read_pressure(double& avg10)
+{
+    string file = cgroup_.empty() ? "/proc/pressure/memory" : cgroup_ + "/memory.pressure";
+    ifstream in(file.c_str());
+    if (!in.good() && !cgroup_.empty())
+        in.open("/proc/pressure/memory");
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    string kind, field;
+    if (!(in >> kind >> field) || kind != "some" || field.compare(0, 6, "avg10=") != 0)
+        return false;
+    avg10 = strtod(field.c_str() + 6, NULL);
+    return true;
+}
+
+bool MemoryBudget::under_pressure()
+{
+    double avg10;
+    if (read_pressure(avg10) && avg10 > PRESSURE_)
+        return true;
+    unsigned long long limit, free;
+    return read_limits(limit, free) && free < limit / LOW_WATERMARK_;
+}
@@ -0,0 +1,79 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMBUDGET_H
+#define MEMBUDGET_H
+
+#include <string>
+
+/**
+ * Works out how many bytes the reuse cache may hold from what the machine
+ * and the container actually have: the cgroup v2 memory.max and
+ * memory.current of the process, and MemTotal/MemAvailable from
+ * /proc/meminfo. Memory pressure is read from PSI, memory.pressure of the
+ * cgroup or /proc/pressure/memory. Whatever cannot be read is ignored.
+ */
+class MemoryBudget
+{
+    public:
+        MemoryBudget();
+
+        /**
+         * Bytes the process needs beside the cache: the loaded tables and
+         * the output of a query.
+         */
+        void set_reserved(unsigned long long bytes)
+        {
+            reserved_ = bytes;
+        }
+
+        /**
+         * Bytes the cache may use while it holds \a cache_bytes: a share of
+         * the limit left after the reserved bytes, and no more than the
+         * cache plus what is still free.
+         */
+        unsigned long long get_budget(unsigned long long cache_bytes);
+
+        /**
+         * True when the kernel reports stalls on memory above PRESSURE_
+         * percent over the last 10 seconds, or free memory fell below
+         * 1/LOW_WATERMARK_ of the limit.
+         */
+        bool under_pressure();
+
+    private:
+        /**
+         * Smaller of memory.max and the physical memory, and the free part
+         * of it. Without /proc/meminfo the physical memory comes from sysconf().
+         */
+        bool read_limits(unsigned long long& limit, unsigned long long& free);
+
+        /** "some avg10" of the PSI file, in percent. */
+        bool read_pressure(double& avg10);
+
+        /** Reads one number from \a file, false if absent or "max". */
+        bool read_value(const std::string& file, unsigned long long& value);
+
+        static const unsigned int CACHE_SHARE_ = 4;     ///< the cache gets 3/4 of the room
+        static const unsigned int LOW_WATERMARK_ = 16;
+        static const double PRESSURE_;
+
+        std::string cgroup_;    ///< cgroup v2 directory of the process, empty if none
+        unsigned long long reserved_;
+};
+
+#endif // MEMBUDGET_H
@@ -86,12 +86,12 @@ class Buffer
         /**
          * Returns the capacity of this buffer.
          */
-        inline const unsigned int capacity() { return maxsize_; }
+        inline unsigned int capacity() { return maxsize_; }
 
         /**
          * Returns the used space of this buffer.
          */
-        inline const unsigned int get_used_space();
+        inline unsigned int get_used_space();
 
     protected:
         /** Data segment of page. */
@@ -331,7 +331,7 @@ inline void* Buffer::atomic_allocate(unsigned int len)
     return newval;
 }
 
-inline const unsigned int Buffer::get_used_space()
+inline unsigned int Buffer::get_used_space()
 {
     return reinterpret_cast<char*>(free_) - reinterpret_cast<char*>(data_);
 }
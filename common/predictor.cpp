@@ -0,0 +1,76 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "predictor.h"
+
+void RangePredictor::observe(unsigned long long start, unsigned long long end)
+{
+    history_[next_].start_value_ = start;
+    history_[next_].end_value_ = end;
+    next_ = (next_ + 1) % HISTORY_;
+    nranges_ = nranges_ < HISTORY_ ? nranges_ + 1 : HISTORY_;
+}
+
+bool RangePredictor::predict(unsigned long long& start, unsigned long long& end)
+{
+    return predict_stride(start, end) || predict_frequent(start, end);
+}
+
+bool RangePredictor::predict_stride(unsigned long long& start, unsigned long long& end)
+{
+    // two equal steps of an equally wide window
+    if (nranges_ < 3)
+        return false;
+    range& r0 = recent(0);
+    range& r1 = recent(1);
+    range& r2 = recent(2);
+    long long step = r0.start_value_ - r1.start_value_;
+    if (step == 0 || step != (long long)(r1.start_value_ - r2.start_value_)
+            || r0.end_value_ - r0.start_value_ != r1.end_value_ - r1.start_value_
+            || r1.end_value_ - r1.start_value_ != r2.end_value_ - r2.start_value_)
+        return false;
+    if (step < 0 && r0.start_value_ < (unsigned long long)-step)
+        return false;
+    start = r0.start_value_ + step;
+    end = r0.end_value_ + step;
+    return true;
+}
+
+bool RangePredictor::predict_frequent(unsigned long long& start, unsigned long long& end)
+{
+    // the most repeated range, other than the one that just ran
+    unsigned int best = 1;
+    for (unsigned int i = 1; i < nranges_; ++i)
+    {
+        range& r = recent(i);
+        if (r.start_value_ == recent(0).start_value_ && r.end_value_ == recent(0).end_value_)
+            continue;
+        unsigned int count = 0;
+        for (unsigned int j = 1; j < nranges_; ++j)
+        {
+            if (recent(j).start_value_ == r.start_value_ && recent(j).end_value_ == r.end_value_)
+                ++count;
+        }
+        if (count > best)
+        {
+            best = count;
+            start = r.start_value_;
+            end = r.end_value_;
+        }
+    }
+    return best > 1;
+}
@@ -0,0 +1,65 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+/**
+ * Guesses the next query range from the recent [cond_s, cond_e] sequence.
+ * Two patterns are recognized: a window sliding by a fixed step, and a
+ * range that keeps coming back.
+ */
+class RangePredictor
+{
+    public:
+        RangePredictor()
+            : nranges_(0), next_(0)
+        { }
+
+        /** Records the range of a query that just ran. */
+        void observe(unsigned long long start, unsigned long long end);
+
+        /**
+         * Fills \a start and \a end with the likely next range. Returns
+         * false if the history shows no pattern.
+         */
+        bool predict(unsigned long long& start, unsigned long long& end);
+
+    private:
+        struct range
+        {
+            unsigned long long start_value_;
+            unsigned long long end_value_;
+        };
+
+        /** The \a i-th most recent range, 0 is the last one observed. */
+        inline range& recent(unsigned int i)
+        {
+            return history_[(next_ + HISTORY_ - 1 - i) % HISTORY_];
+        }
+
+        bool predict_stride(unsigned long long& start, unsigned long long& end);
+        bool predict_frequent(unsigned long long& start, unsigned long long& end);
+
+        static const unsigned int HISTORY_ = 16;
+
+        range history_[HISTORY_];
+        unsigned int nranges_;
+        unsigned int next_;
+};
+
+#endif // PREDICTOR_H
@@ -0,0 +1,168 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "results.h"
+#include <iostream>
+
+using namespace std;
+
+result_node::result_node(const result_key& key, const IntervalSet& keys, Schema* out,
+        unsigned int pagesize)
+    : key_(key), keys_(keys), schema_(*out), pagesize_(pagesize),
+      width_((keys.hi() - keys.lo()) / PARTS_ + 1), parts_(PARTS_, (part*)NULL),
+      tuples_(0), bytes_(0), last_use_(0)
+{
+}
+
+result_node::~result_node()
+{
+    for (unsigned int i = 0; i < parts_.size(); ++i)
+    {
+        if (parts_[i])
+        {
+            parts_[i]->rows_.close();
+            delete parts_[i];
+        }
+    }
+}
+
+ResultCache::~ResultCache()
+{
+    for (unsigned int i = 0; i < nodes_.size(); ++i)
+    {
+        delete nodes_[i];
+    }
+    cache_->set_shared_bytes(0);
+}
+
+WriteTable* ResultCache::answer(const result_key& key, const IntervalSet& keys)
+{
+    vector<result_node*>::iterator it = nodes_.begin();
+    while (it != nodes_.end() && !((*it)->key_ == key && (*it)->keys_.contains(keys)))
+    {
+        ++it;
+    }
+    if (it == nodes_.end())
+    {
+        return NULL;
+    }
+    result_node* node = *it;
+    node->last_use_ = ++clock_;
+
+    WriteTable* ret = new WriteTable();
+    ret->init(&node->schema_, node->pagesize_);
+    unsigned long long base = node->keys_.lo();
+    for (unsigned int i = 0; i < node->parts_.size(); ++i)
+    {
+        result_node::part* p = node->parts_[i];
+        unsigned long long lo = base + i * node->width_;
+        if (NULL == p || !keys.overlaps(IntervalSet(lo, lo + node->width_ - 1)))
+        {
+            continue;
+        }
+        // inner partitions are taken whole, edge ones tuple by tuple
+        bool whole = keys.contains(IntervalSet(lo, lo + node->width_ - 1));
+        unsigned long long n = 0;
+        for (LinkedTupleBuffer* page = p->rows_.get_root(); page; page = page->get_next())
+        {
+            void* tup;
+            for (unsigned int j = 0; (tup = page->get_tuple_offset(j)); ++j, ++n)
+            {
+                if (whole || keys.contains(p->keys_[n]))
+                {
+                    ret->append(tup);
+                }
+            }
+        }
+    }
+    cout << "Answered from cached result[" << node->keys_.lo() << "," << node->keys_.hi()
+         << "]!" << flush << endl;
+    return ret;
+}
+
+result_node* ResultCache::record(const result_key& key, const IntervalSet& keys,
+        Schema* out, unsigned int pagesize)
+{
+    return new result_node(key, keys, out, pagesize);
+}
+
+void ResultCache::publish(result_node* node)
+{
+    for (unsigned int i = 0; i < node->parts_.size(); ++i)
+    {
+        result_node::part* p = node->parts_[i];
+        if (p)
+        {
+            node->tuples_ += p->keys_.size();
+            node->bytes_ += sizeof(result_node::part) + p->rows_.get_size()
+                + p->keys_.capacity() * sizeof(unsigned long long);
+        }
+    }
+    node->bytes_ += sizeof(result_node) + node->parts_.size() * sizeof(result_node::part*);
+    node->last_use_ = ++clock_;
+
+    // results the new one contains will not be asked for again
+    vector<result_node*>::iterator it = nodes_.begin();
+    while (it != nodes_.end())
+    {
+        if ((*it)->key_ == node->key_ && node->keys_.contains((*it)->keys_))
+        {
+            evict(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    nodes_.push_back(node);
+    bytes_ += node->bytes_;
+    fit();
+}
+
+void ResultCache::fit()
+{
+    unsigned long long room = max_bytes_;
+    unsigned long long max_bytes = cache_->get_max_bytes();
+    if (max_bytes > 0)
+    {
+        unsigned long long tables = cache_->get_bytes() + cache_->get_frozen_bytes();
+        unsigned long long left = tables < max_bytes ? max_bytes - tables : 0;
+        room = left < room ? left : room;
+    }
+    while (bytes_ > room)
+    {
+        vector<result_node*>::iterator victim = nodes_.begin();
+        for (vector<result_node*>::iterator it = nodes_.begin(); it != nodes_.end(); ++it)
+        {
+            if ((*it)->last_use_ < (*victim)->last_use_)
+            {
+                victim = it;
+            }
+        }
+        cout << "Evict cached result[" << (*victim)->keys_.lo() << ","
+             << (*victim)->keys_.hi() << "]" << flush << endl;
+        evict(victim);
+    }
+    cache_->set_shared_bytes(bytes_);
+}
+
+void ResultCache::evict(vector<result_node*>::iterator it)
+{
+    bytes_ -= (*it)->bytes_;
+    delete *it;
+    nodes_.erase(it);
+}
@@ -0,0 +1,145 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include "cache.h"
+#include "intervals.h"
+#include "schema.h"
+#include "table.h"
+#include <vector>
+
+using std::vector;
+
+/**
+ * What a join result was computed from: the build side, with the columns
+ * it contributes and its filter, and the probe side with its columns.
+ */
+struct result_key
+{
+    result_key() { }
+    result_key(const cache_key& build, const cache_key& probe)
+        : build_(build), probe_(probe) { }
+
+    bool operator==(const result_key& other) const
+    {
+        return build_ == other.build_ && probe_ == other.probe_;
+    }
+
+    cache_key build_;
+    cache_key probe_;
+};
+
+/**
+ * The output tuples of one query, with the join key of every tuple, in
+ * partitions of width_ consecutive keys. A query inside keys_ copies the
+ * partitions it covers and checks the keys of the two at its edges only.
+ */
+struct result_node
+{
+    result_node(const result_key& key, const IntervalSet& keys, Schema* out, unsigned int pagesize);
+    ~result_node();
+
+    /** Records an output \a tuple joined on \a key, see BaseAlgo::set_recorder(). */
+    inline void add(unsigned long long key, const void* tuple)
+    {
+        part* p = parts_[(key - keys_.lo()) / width_];
+        if (NULL == p)
+        {
+            p = parts_[(key - keys_.lo()) / width_] = new part;
+            p->rows_.init(&schema_, pagesize_);
+        }
+        p->keys_.push_back(key);
+        p->rows_.append(tuple);
+    }
+
+    struct part
+    {
+        vector<unsigned long long> keys_;   ///< key of each tuple, in order
+        WriteTable rows_;
+    };
+
+    static const unsigned int PARTS_ = 64;
+
+    result_key key_;
+    IntervalSet keys_;          ///< keys of the query that produced it
+    Schema schema_;             ///< of the output tuples
+    unsigned int pagesize_;
+    unsigned long long width_;  ///< keys per partition
+    vector<part*> parts_;       ///< NULL where no tuple joined
+    unsigned long long tuples_;
+    unsigned long long bytes_;  ///< counted by ResultCache::publish()
+    unsigned long long last_use_;
+};
+
+/**
+ * Join results of earlier queries. A query whose keys lie within those of
+ * a recorded one, with the same key, is answered by copying the matching
+ * tuples instead of building and probing.
+ *
+ * The results live under a byte cap of their own and under the byte
+ * budget of the ReuseCache, if that has one: they take what the cached
+ * tables leave, and the cache counts them when it collects.
+ */
+class ResultCache
+{
+    public:
+        ResultCache(ReuseCache* cache, unsigned long long max_bytes)
+            : cache_(cache), bytes_(0), max_bytes_(max_bytes), clock_(0) { }
+        ~ResultCache();
+
+        /**
+         * The output of the query \a key on \a keys, or NULL if no recorded
+         * result contains it. The table refers to the schema of the result,
+         * close it before the next publish() or fit().
+         */
+        WriteTable* answer(const result_key& key, const IntervalSet& keys);
+
+        /**
+         * Starts recording the output of the query \a key on \a keys, whose
+         * tuples have the schema \a out. Hand the node to the joiner, then
+         * to publish() once the probe is over.
+         */
+        result_node* record(const result_key& key, const IntervalSet& keys,
+                Schema* out, unsigned int pagesize);
+
+        /**
+         * Keeps \a node for later queries, dropping the results it contains,
+         * and evicts the least recently used ones to stay in budget.
+         */
+        void publish(result_node* node);
+
+        /**
+         * Evicts the least recently used results until they fit in their
+         * cap and beside the cached tables, after a change of the byte budget.
+         */
+        void fit();
+
+        unsigned long long get_bytes() { return bytes_; }
+
+    private:
+        void evict(vector<result_node*>::iterator it);
+
+        ReuseCache* cache_;
+        vector<result_node*> nodes_;
+        unsigned long long bytes_;
+        unsigned long long max_bytes_;  ///< cap of the results, whatever the cache allows
+        unsigned long long clock_;  ///< stamps last_use_
+};
+
+#endif // RESULTS_H
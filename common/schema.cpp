@@ -282,7 +282,7 @@ string Schema::pretty_print(void* tuple, char sep)
 {
     string ret;
     const vector<string>& tokens = output_tuple(tuple);
-    for (int i=0; i<tokens.size()-1; ++i)
+    for (unsigned int i=0; i+1<tokens.size(); ++i)
         ret += tokens[i] + sep;
     if (tokens.size() > 1)
         ret += tokens[tokens.size()-1];
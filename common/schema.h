@@ -95,7 +95,7 @@ inline unsigned int Schema::get_tuple_size()
 
 inline void Schema::write_data(void* dest, unsigned int pos, const void * const data)
 {
-    void* d = reinterpret_cast<void*>(dest)+offset_[pos];
+    void* d = reinterpret_cast<char*>(dest)+offset_[pos];
 
     switch(vct_[pos])
     {
@@ -129,7 +129,7 @@ inline void Schema::write_data(void* dest, unsigned int pos, const void * const
             char* t = reinterpret_cast<char*>(d);
 
             //write p in t
-            while (*(t++) = *(p++))
+            while ((*(t++) = *(p++)))
                 ;
             break;
         }
@@ -0,0 +1,190 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include "stats.h"
+#include "hash.h"
+#include "table.h"
+
+void Histogram::build(vector<long long>& sample, unsigned long long rows)
+{
+    buckets_.clear();
+    unsigned long long n = sample.size();
+    if (0 == n)
+    {
+        return;
+    }
+    std::sort(sample.begin(), sample.end());
+    unsigned long long nbuckets = n < BUCKETS_ ? n : BUCKETS_;
+    for (unsigned long long i = 0; i < nbuckets; ++i)
+    {
+        unsigned long long first = i * n / nbuckets;
+        unsigned long long last = (i + 1) * n / nbuckets - 1;
+        bucket b;
+        b.lo_ = sample[first];
+        b.hi_ = sample[last];
+        b.rows_ = (double)(last - first + 1) * rows / n;
+        buckets_.push_back(b);
+    }
+}
+
+double Histogram::estimate(long long lo, long long hi) const
+{
+    double rows = 0;
+    for (unsigned int i = 0; i < buckets_.size(); ++i)
+    {
+        const bucket& b = buckets_[i];
+        if (hi < b.lo_ || lo > b.hi_)
+        {
+            continue;
+        }
+        long long l = lo > b.lo_ ? lo : b.lo_;
+        long long h = hi < b.hi_ ? hi : b.hi_;
+        rows += b.rows_ * ((double)h - l + 1) / ((double)b.hi_ - b.lo_ + 1);
+    }
+    return rows;
+}
+
+void DistinctSketch::add(long long value)
+{
+    unsigned int h = murmurhash2(&value, sizeof(value), 0);
+    unsigned int idx = h >> (32 - PRECISION_);
+    unsigned int rest = h << PRECISION_;
+    unsigned char rank = rest ? __builtin_clz(rest) + 1 : 32 - PRECISION_ + 1;
+    if (rank > registers_[idx])
+    {
+        registers_[idx] = rank;
+    }
+}
+
+double DistinctSketch::estimate() const
+{
+    double m = registers_.size();
+    double sum = 0;
+    unsigned int zeros = 0;
+    for (unsigned int i = 0; i < registers_.size(); ++i)
+    {
+        sum += ldexp(1.0, -(int)registers_[i]);
+        zeros += 0 == registers_[i];
+    }
+    double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    // linear counting while many registers are still empty
+    if (e <= 2.5 * m && zeros > 0)
+    {
+        return m * log(m / zeros);
+    }
+    // hash collisions of the 32-bit hash
+    const double two32 = 4294967296.0;
+    if (e > two32 / 30)
+    {
+        return -two32 * log(1 - e / two32);
+    }
+    return e;
+}
+
+void ColumnStats::add(long long value)
+{
+    ++rows_;
+    distinct_.add(value);
+    if (sample_.size() < SAMPLE_)
+    {
+        sample_.push_back(value);
+        return;
+    }
+    // reservoir sampling, every value stays with probability SAMPLE_/rows_
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 7;
+    seed_ ^= seed_ << 17;
+    unsigned long long slot = seed_ % rows_;
+    if (slot < SAMPLE_)
+    {
+        sample_[slot] = value;
+    }
+}
+
+void ColumnStats::finish()
+{
+    histogram_.build(sample_, rows_);
+    vector<long long>().swap(sample_);
+}
+
+double ColumnStats::estimate_rows(long long lo, long long hi) const
+{
+    return histogram_.estimate(lo, hi);
+}
+
+double ColumnStats::estimate_distinct(long long lo, long long hi) const
+{
+    if (0 == rows_)
+    {
+        return 0;
+    }
+    double distinct = distinct_.estimate();
+    distinct = distinct < rows_ ? distinct : rows_;
+    double rows = estimate_rows(lo, hi);
+    double ret = distinct * rows / rows_;
+    return ret < rows ? ret : rows;
+}
+
+TableStats::~TableStats()
+{
+    for (unsigned int i = 0; i < columns_.size(); ++i)
+    {
+        delete columns_[i];
+    }
+}
+
+void TableStats::collect(Table* t, const vector<unsigned int>& columns)
+{
+    Schema* s = t->schema();
+    columns_.assign(s->columns(), NULL);
+    for (unsigned int i = 0; i < columns.size(); ++i)
+    {
+        unsigned int c = columns[i];
+        if (c < s->columns() && NULL == columns_[c]
+                && (CT_INTEGER == s->get_column_type(c) || CT_LONG == s->get_column_type(c)))
+        {
+            columns_[c] = new ColumnStats();
+        }
+    }
+
+    for (LinkedTupleBuffer* page = t->get_root(); page; page = page->get_next())
+    {
+        unsigned int i = 0;
+        void* tup;
+        while ((tup = page->get_tuple_offset(i++)))
+        {
+            for (unsigned int c = 0; c < columns_.size(); ++c)
+            {
+                if (NULL == columns_[c])
+                {
+                    continue;
+                }
+                columns_[c]->add(CT_LONG == s->get_column_type(c) ? s->as_long(tup, c) : s->as_int(tup, c));
+            }
+        }
+    }
+
+    for (unsigned int c = 0; c < columns_.size(); ++c)
+    {
+        if (columns_[c])
+        {
+            columns_[c]->finish();
+        }
+    }
+}
@@ -0,0 +1,138 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <vector>
+
+using std::vector;
+
+class Table;
+
+/**
+ * Equi-depth histogram of an integer column: every bucket holds about the
+ * same number of tuples, so skewed ranges get narrow buckets. Values are
+ * assumed evenly spread inside a bucket.
+ */
+class Histogram
+{
+    public:
+        Histogram() { }
+
+        /**
+         * Builds the buckets from \a sample, which is sorted in place, and
+         * scales them to \a rows tuples.
+         */
+        void build(vector<long long>& sample, unsigned long long rows);
+
+        /** Estimated number of tuples with \a lo <= value <= \a hi. */
+        double estimate(long long lo, long long hi) const;
+
+        bool empty() const { return buckets_.empty(); }
+
+    private:
+        static const unsigned int BUCKETS_ = 64;
+
+        struct bucket
+        {
+            long long lo_;      ///< smallest value of the bucket
+            long long hi_;      ///< largest value of the bucket
+            double rows_;
+        };
+        vector<bucket> buckets_;
+};
+
+/**
+ * HyperLogLog sketch of the distinct values of a column, 2^PRECISION_
+ * one-byte registers and about 1.6% standard error.
+ */
+class DistinctSketch
+{
+    public:
+        DistinctSketch() : registers_(1 << PRECISION_, 0) { }
+
+        void add(long long value);
+
+        /** Estimated number of distinct values added. */
+        double estimate() const;
+
+    private:
+        static const unsigned int PRECISION_ = 12;
+        vector<unsigned char> registers_;
+};
+
+/**
+ * Statistics of one integer column: the row count, a histogram built from
+ * a reservoir sample of the values and a distinct-count sketch.
+ */
+class ColumnStats
+{
+    public:
+        ColumnStats() : rows_(0), seed_(88172645463325252ULL) { }
+
+        /** Adds one value while the table is scanned. */
+        void add(long long value);
+
+        /** Builds the histogram once all values are in. */
+        void finish();
+
+        unsigned long long get_rows() const { return rows_; }
+
+        /** Estimated number of tuples with \a lo <= value <= \a hi. */
+        double estimate_rows(long long lo, long long hi) const;
+
+        /**
+         * Estimated number of distinct values in [\a lo, \a hi], taking the
+         * distinct values to be spread like the tuples.
+         */
+        double estimate_distinct(long long lo, long long hi) const;
+
+    private:
+        static const unsigned int SAMPLE_ = 1 << 16;
+
+        unsigned long long rows_;
+        unsigned long long seed_;   ///< xorshift state of the reservoir
+        vector<long long> sample_;  ///< dropped by finish()
+        Histogram histogram_;
+        DistinctSketch distinct_;
+};
+
+/**
+ * Statistics of some integer columns of a table, see
+ * \ref WriteTable::load(). Other columns have none.
+ */
+class TableStats
+{
+    public:
+        ~TableStats();
+
+        /** Scans all pages of \a t for the integer columns among \a columns. */
+        void collect(Table* t, const vector<unsigned int>& columns);
+
+        /** Statistics of column \a pos, NULL if none were collected. */
+        const ColumnStats* column(unsigned int pos) const
+        {
+            return pos < columns_.size() ? columns_[pos] : NULL;
+        }
+
+    private:
+        vector<ColumnStats*> columns_;
+};
+
+#endif // STATS_H
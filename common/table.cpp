@@ -28,7 +28,7 @@
 
 
 
-void Table::init(Schema *s, unsigned int size)
+void Table::init(Schema *s, unsigned int /*size*/)
 {
     schema_ = s;
     data_head_ = 0;
@@ -44,6 +44,8 @@ void Table::close()
         delete data_head_;
         data_head_ = t;
     }
+    delete stats_;
+    stats_ = NULL;
     reset();
 }
 
@@ -135,6 +137,28 @@ void WriteTable::append(const void * const src)
     }
 }
 
+unsigned long long Table::get_size()
+{
+    unsigned long long bytes = 0;
+    for (LinkedTupleBuffer* page = data_head_; page; page = page->get_next())
+    {
+        bytes += sizeof(LinkedTupleBuffer) + page->capacity();
+    }
+    return bytes;
+}
+
+void PageDirectory::init(Table* t)
+{
+    pages_.clear();
+    index_.clear();
+    slots_ = t->get_root()->capacity() / t->schema()->get_tuple_size();
+    for (LinkedTupleBuffer* page = t->get_root(); page; page = page->get_next())
+    {
+        index_[page] = pages_.size();
+        pages_.push_back(page);
+    }
+}
+
 void WriteTable::concatenate(const WriteTable& table)
 {
     if(schema_->get_tuple_size() == table.schema_->get_tuple_size())
@@ -209,10 +233,13 @@ LinkedTupleBuffer* find_chain_end(LinkedTupleBuffer* head)
 }
 
 Table::LoadErrorT WriteTable::load(const string& filepattern,
-        const string& separators)
+        const string& separators, const vector<unsigned int>& columns)
 {
     Loader loader(separators[0]);
     loader.load(filepattern, *this);
+    delete stats_;
+    stats_ = new TableStats();
+    stats_->collect(this, columns);
     return LOAD_OK;
 }
 
@@ -228,7 +255,7 @@ void Table::print_table()
         while (tuple)
         {
             cout<< *reinterpret_cast<long long*>(tuple)<< " ";
-            cout<< *reinterpret_cast<long long*>(tuple+sizeof(long long))<< " ";
+            cout<< *reinterpret_cast<long long*>((char*)tuple+sizeof(long long))<< " ";
             tuple = ret->get_tuple_offset((++idx));
         }
         //cout<< endl;
@@ -18,11 +18,13 @@
 #ifndef TABLE_H
 #define TABLE_H
 
+#include<map>
 #include<string>
 #include<vector>
 #include "schema.h"
 #include "page.h"
 #include "lock.h"
+#include "stats.h"
 #include "exceptions.h"
 
 class TupleBufferCursor;
@@ -68,7 +70,7 @@ class TupleBufferCursor
 class Table : public TupleBufferCursor
 {
     public:
-        Table() : schema_(NULL), data_head_(NULL), cur_(NULL) { }
+        Table() : schema_(NULL), data_head_(NULL), cur_(NULL), stats_(NULL) { }
         virtual ~Table() { }
 
         enum LoadErrorT
@@ -77,7 +79,8 @@ class Table : public TupleBufferCursor
         };
 
         virtual LoadErrorT load(const string& filepattern,
-                const string& separators) = 0;
+                const string& separators,
+                const vector<unsigned int>& columns = vector<unsigned int>()) = 0;
 
         virtual void init(Schema* s, unsigned int size);
 
@@ -146,10 +149,20 @@ class Table : public TupleBufferCursor
         vector<PageCursor*> split(int nthreads);
 
         void print_table();
+
+        /** Bytes held by the pages of the table. Walks all of them. */
+        unsigned long long get_size();
+
+        /** Column statistics gathered by load(), NULL before. */
+        const TableStats* get_stats()
+        {
+            return stats_;
+        }
     protected:
         Schema* schema_;
         LinkedTupleBuffer* data_head_;
         /* volatile */ LinkedTupleBuffer* cur_;
+        TableStats* stats_;
 };
 
 class WriteTable : public Table {
@@ -162,9 +175,12 @@ class WriteTable : public Table {
 
         /**
          * Loads a single text file, where each line is a tuple and each field
-         * is separated by any character in the \a separators string.
+         * is separated by any character in the \a separators string. Then
+         * collects the statistics of the integer columns among \a columns,
+         * those that joins and predicates read.
          */
-        LoadErrorT load(const string& filepattern, const string& separators);
+        LoadErrorT load(const string& filepattern, const string& separators,
+                const vector<unsigned int>& columns = vector<unsigned int>());
 
         /**
          * Appends the \a input at the end of this table, creating new
@@ -196,6 +212,101 @@ class AtomicWriteTable : public WriteTable {
         Lock lock_;
 };
 
+/**
+ * Read cursor over the pages of a \ref Table that is independent of the
+ * table's own cursor, so another thread can scan the same table.
+ */
+class TableScan : public PageCursor {
+    public:
+        TableScan(Table* t)
+            : table_(t), cur_(t->get_root())
+        { }
+
+        virtual LinkedTupleBuffer* read_next()
+        {
+            LinkedTupleBuffer* ret = cur_;
+            if (cur_)
+                cur_ = cur_->get_next();
+            return ret;
+        }
+
+        virtual LinkedTupleBuffer* atomic_read_next()
+        {
+            LinkedTupleBuffer* oldval;
+            LinkedTupleBuffer* newval;
+
+            newval = cur_;
+
+            do
+            {
+                if (newval == NULL)
+                    return NULL;
+
+                oldval = newval;
+                newval = oldval->get_next();
+                newval = (LinkedTupleBuffer*)atomic_compare_and_swap((void**)&cur_, oldval, newval);
+
+            } while (newval != oldval);
+
+            return newval;
+        }
+
+        virtual Schema* schema() { return table_->schema(); }
+
+        virtual void reset() { cur_ = table_->get_root(); }
+
+        virtual vector<PageCursor*> split(int /*nthreads*/)
+        {
+            cout<<"not implement!"<<endl;
+            throw NotYetImplemented();
+        }
+
+    private:
+        Table* table_;
+        LinkedTupleBuffer* cur_;
+};
+
+/**
+ * Numbers the tuples of a \ref Table by page and slot, so that they can be
+ * referred to by a 32-bit row id instead of a pointer. All pages of the
+ * table hold the same number of tuples, and the table must not change
+ * while row ids are in use.
+ */
+class PageDirectory {
+    public:
+        PageDirectory() : slots_(0) { }
+
+        void init(Table* t);
+
+        /**
+         * Row id of the first tuple of \a page, a page of the table. Throws
+         * UnknownPageException for pages of other tables.
+         */
+        inline unsigned int first_row(Page* page)
+        {
+            map<Page*, unsigned int>::const_iterator it = index_.find(page);
+            if (it == index_.end())
+                throw UnknownPageException();
+            return it->second * slots_;
+        }
+
+        /** The tuple called \a rowid. */
+        inline void* get_tuple(unsigned int rowid)
+        {
+            return pages_[rowid / slots_]->get_tuple_offset(rowid % slots_);
+        }
+
+        inline bool is_init()
+        {
+            return slots_ != 0;
+        }
+
+    private:
+        vector<Page*> pages_;
+        map<Page*, unsigned int> index_;
+        unsigned int slots_;    ///< tuples per page
+};
+
 class FakeTable : public PageCursor {
     public:
         FakeTable(Schema* s)
@@ -222,7 +333,7 @@ class FakeTable : public PageCursor {
 
         virtual void reset() { first_time_ = true; }
 
-        virtual vector<PageCursor*> split(int nthreads)
+        virtual vector<PageCursor*> split(int /*nthreads*/)
         {
             cout<<"not implement!"<<endl;
             throw NotYetImplemented();
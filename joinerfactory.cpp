@@ -20,6 +20,34 @@
 
 using namespace std;
 
+// the OUTPUT_* build flags only pick the default of algorithm.output
+#if defined(OUTPUT_AGGREGATE)
+static const char* default_output = "aggregate";
+#elif defined(OUTPUT_ASSEMBLE) && defined(OUTPUT_WRITE_NORMAL)
+static const char* default_output = "write";
+#elif defined(OUTPUT_ASSEMBLE) && defined(OUTPUT_WRITE_NT)
+static const char* default_output = "write-nt";
+#elif defined(OUTPUT_ASSEMBLE)
+static const char* default_output = "assemble";
+#else
+static const char* default_output = "discard";
+#endif
+
+unsigned int JoinerFactory::parseOutput(const string& name)
+{
+    if("discard" == name)
+        return output_mode::DISCARD;
+    if("assemble" == name)
+        return output_mode::ASSEMBLE;
+    if("write" == name)
+        return output_mode::WRITE;
+    if("write-nt" == name)
+        return output_mode::WRITE_NT;
+    if("aggregate" == name)
+        return output_mode::AGGREGATE;
+    throw UnknownOutputException();
+}
+
 BaseAlgo* JoinerFactory::createJoiner(const libconfig::Config& root)
 {
     BaseAlgo* joiner;
@@ -31,10 +59,19 @@ BaseAlgo* JoinerFactory::createJoiner(const libconfig::Config& root)
     {
         joiner = new ProbePhase< BuildPhase< StoreCopy > >(cfg);
     }
+    else if("adaptive" == copydata)
+    {
+        // copy or row ids, table by table
+        joiner = new AdaptiveJoiner(cfg);
+    }
     else
     {
         joiner =  new ProbePhase< BuildPhase< StorePointer > >(cfg);
     }
 
+    string output = default_output;
+    root.lookupValue("algorithm.output", output);
+    joiner->set_output(parseOutput(output));
+
     return joiner;
 }
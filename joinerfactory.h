@@ -26,6 +26,12 @@ class JoinerFactory
 {
     public:
         static BaseAlgo* createJoiner(const libconfig::Config& root);
+
+        /**
+         * The output_mode named \a name: "discard", "assemble", "write",
+         * "write-nt" or "aggregate".
+         */
+        static unsigned int parseOutput(const std::string& name);
 };
 
 #endif // JOINERFACTORY_H
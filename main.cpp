@@ -24,6 +24,10 @@
 #include <libconfig.h++>
 #include "algo/algo.h"
 #include "joinerfactory.h"
+#include "algo/speculator.h"
+#include "common/predictor.h"
+#include "common/membudget.h"
+#include <cctype>
 #include <cstdlib>
 #include <ctime>
 #include "common/rdtsc.h"
@@ -44,6 +48,65 @@ vector<unsigned int> createIntVector(const Setting& line)
     return ret;
 }
 
+const char* aggNames[] = {"count", "sum", "min", "max"};
+
+void printAggregate(const agg_spec& spec, const agg_value& total, const GroupTable& groups)
+{
+    agg_value all = total;
+    all.merge(groups.total());
+    cout << "Aggregate ";
+    for(const char* c = aggNames[spec.func_]; *c; c++)
+        cout << (char)toupper(*c);
+    if(agg_spec::COUNT != spec.func_)
+        cout << "(" << spec.column_ + 1 << ")";
+    cout << ": ";
+    if(0 == all.count_ && agg_spec::COUNT != spec.func_)
+        cout << "NULL";
+    else
+        cout << all.get(spec.func_);
+    if(spec.grouped())
+        cout << " in " << groups.size() << " groups by column " << spec.group_ + 1;
+    cout << flush << endl;
+}
+
+/** True if output column \a pos of the join is an integer. */
+bool isIntegerOutput(Schema& s1, const vector<unsigned int>& select1,
+        Schema& s2, const vector<unsigned int>& select2, unsigned int pos)
+{
+    ColumnType ct;
+    if(pos < select1.size())
+        ct = s1.get_column_type(select1[pos]);
+    else if(pos < select1.size() + select2.size())
+        ct = s2.get_column_type(select2[pos - select1.size()]);
+    else
+        return false;
+    return CT_INTEGER == ct || CT_LONG == ct;
+}
+
+
+/** The keys of a query on [cond_s, cond_e], see algorithm.ranges. */
+IntervalSet slicePredicate(unsigned long long cond_s, unsigned long long cond_e, unsigned int ranges)
+{
+    // the pieces take every other of 2*ranges-1 equal slots of the window
+    IntervalSet pred;
+    unsigned long long slot = (cond_e - cond_s + 1) / (2 * ranges - 1);
+    for(unsigned int r = 0; r < ranges && slot > 0; r++)
+    {
+        pred.add(cond_s + 2 * r * slot, r + 1 < ranges ? cond_s + (2 * r + 1) * slot - 1 : cond_e);
+    }
+    return pred;
+}
+/** Bytes of an output tuple of the join, laid out as BaseAlgo::init() does. */
+unsigned int outputTupleSize(Schema& s1, const vector<unsigned int>& select1,
+        Schema& s2, const vector<unsigned int>& select2)
+{
+    Schema out;
+    for(unsigned int i = 0; i < select1.size(); i++)
+        out.add(s1.get(select1[i]));
+    for(unsigned int i = 0; i < select2.size(); i++)
+        out.add(s2.get(select2[i]));
+    return out.get_tuple_size();
+}
 
 BaseAlgo* joiner;
 unsigned int joinattr1, joinattr2;
@@ -92,6 +155,24 @@ int main(int argc, char** argv)
     unsigned int selectivity;
     unsigned long long total;
     unsigned long long cond_s, cond_e;
+    unsigned int step = 0;
+    string speculate = "no";
+    string resultcache = "no";
+    string aggregate;
+    unsigned int aggcolumn = 1;
+    unsigned int aggroup = 0;
+    unsigned int aggchunk = 1024;
+    string statsfile, statsformat = "json";
+    string snapshot, copydata;
+    string spilldir;
+    unsigned int spillsize = 0;
+    unsigned int freezesize = 0;
+    unsigned int cachesize = 0;
+    unsigned int resultcachesize = 0;
+    unsigned int statsevery = 0;
+    unsigned int ranges = 1;
+    unsigned int inlist = 0;
+    unsigned int filtershrink = 0;
 
     Config cfg;
 
@@ -105,6 +186,51 @@ int main(int argc, char** argv)
     num  = cfg.lookup("algorithm.num");
     selectivity =  cfg.lookup("algorithm.selectivity");
     total = 1048576;/*(unsigned long long)cfg.lookup("algorithm.total");*/
+    // optional: slide the window by a fixed step instead of jumping randomly
+    cfg.lookupValue("algorithm.step", step);
+    // optional: select ranges disjoint pieces of the window, plus inlist random keys
+    cfg.lookupValue("algorithm.ranges", ranges);
+    cfg.lookupValue("algorithm.inlist", inlist);
+    // optional: narrow each end of every filter range by up to filtershrink percent per query
+    cfg.lookupValue("algorithm.filtershrink", filtershrink);
+    cfg.lookupValue("algorithm.speculate", speculate);
+    // optional: answer repeated and nested queries from the results of earlier ones
+    cfg.lookupValue("algorithm.resultcache", resultcache);
+    // optional: cap the cached results at resultcachesize MB, a quarter of the memory budget by default
+    cfg.lookupValue("algorithm.resultcachesize", resultcachesize);
+    // optional: ask for the "count", "sum", "min" or "max" of output column aggcolumn,
+    // grouped on output column aggroup if set, instead of the output. Ungrouped queries
+    // keep aggregates per chunk of aggchunk keys, 0 turns that off
+    cfg.lookupValue("algorithm.aggregate", aggregate);
+    cfg.lookupValue("algorithm.aggcolumn", aggcolumn);
+    cfg.lookupValue("algorithm.aggroup", aggroup);
+    cfg.lookupValue("algorithm.aggchunk", aggchunk);
+    // optional: dump cache statistics every statsevery queries and at the end
+    cfg.lookupValue("algorithm.statsfile", statsfile);
+    cfg.lookupValue("algorithm.statsformat", statsformat);
+    cfg.lookupValue("algorithm.statsevery", statsevery);
+    // optional: keep the cache across runs, only copied entries are position independent
+    cfg.lookupValue("algorithm.snapshot", snapshot);
+    cfg.lookupValue("algorithm.copydata", copydata);
+    // optional: write evicted tables to a disk tier of spillsize MB
+    cfg.lookupValue("algorithm.spilldir", spilldir);
+    cfg.lookupValue("algorithm.spillsize", spillsize);
+    // optional: keep evicted tables compressed in freezesize MB of memory
+    cfg.lookupValue("algorithm.freezesize", freezesize);
+    // optional: fix the cache at cachesize MB instead of sizing it from free memory
+    cfg.lookupValue("algorithm.cachesize", cachesize);
+    // adaptive caches only save their copied tables, see ReuseCache::save()
+    bool copies = "yes" == copydata || "adaptive" == copydata;
+    if(!copies)
+    {
+        snapshot.clear();
+        spilldir.clear();
+    }
+    ofstream statsout;
+    if(!statsfile.empty())
+    {
+        statsout.open((datapath+statsfile).c_str());
+    }
     infilename = (const char*)cfg.lookup("build.file");
     buffsize = cfg.lookup("buffsize");
     sin = Schema::create(cfg.lookup("build.schema"));
@@ -114,6 +240,19 @@ int main(int argc, char** argv)
     joinattr1 = cfg.lookup("build.jattr");
     joinattr1--;
     select1 = createIntVector(cfg.lookup("build.select"));
+    // optional: (column, lo, hi) ranges on other build columns, all must hold
+    vector<unsigned int> fcolumns, flo, fhi;
+    if(cfg.exists("build.filter"))
+    {
+        const Setting& filters = cfg.lookup("build.filter");
+        for(int f = 0; f < filters.getLength(); f++)
+        {
+            unsigned int column = filters[f][0];
+            fcolumns.push_back(column - 1);
+            flo.push_back(filters[f][1]);
+            fhi.push_back(filters[f][2]);
+        }
+    }
 
     sout = Schema::create(cfg.lookup("probe.schema"));
     WriteTable wr2;
@@ -137,14 +276,19 @@ int main(int argc, char** argv)
     // load files in memory
     cout << "Loading files in memory..." << flush;
 
-    wr1.load(datapath+infilename, "|");
+    // statistics only for the join keys and the filtered build columns
+    vector<unsigned int> statcols1(fcolumns);
+    statcols1.push_back(joinattr1);
+    wr1.load(datapath+infilename, "|", statcols1);
 
-    wr2.load(datapath+outfilename, "|");
+    wr2.load(datapath+outfilename, "|", vector<unsigned int>(1, joinattr2));
 
     //wr1.print_table();
 
     //wr2.print_table();
 
+    joiner->set_build_table(tin);
+
     cout << "OK" << endl;
 
     // run hash join
@@ -156,44 +300,280 @@ int main(int argc, char** argv)
     cout << endl;
     cout << "Finishing the joiner init!" << flush<<endl;
 
-    ReuseCache *cache =(ReuseCache*)new ReuseCache(1024*1024);
+    // the key range budget admits the whole domain, memory decides the rest
+    ReuseCache *cache =(ReuseCache*)new ReuseCache(total);
+    MemoryBudget budget;
+    // an output page per probe page at worst
+    budget.set_reserved(wr1.get_size() + 2 * wr2.get_size());
+    cache->set_max_bytes(cachesize > 0 ? (unsigned long long)cachesize << 20 : budget.get_budget(0));
+    if(!snapshot.empty())
+    {
+        cache->load((datapath+snapshot).c_str());
+    }
+    const ColumnStats* jstats = tin->get_stats()->column(joinattr1);
+    cache->set_stats(cache_key(infilename, joinattr1, vector<unsigned int>()), jstats);
+    cout << "Build join column: " << jstats->get_rows() << " tuples, about "
+         << (unsigned long long)jstats->estimate_distinct(0, total) << " distinct keys in [0,"
+         << total << "]" << endl;
+    joiner->set_cache(cache);
+    if(!spilldir.empty() && spillsize > 0)
+    {
+        cache->set_spill((datapath+spilldir).c_str(), (unsigned long long)spillsize << 20);
+    }
+    if(copies && freezesize > 0)
+    {
+        cache->set_freeze((unsigned long long)freezesize << 20);
+    }
+    ResultCache* results = NULL;
+    ChunkAggregates* chunks = NULL;
+    agg_spec spec;
+    if(!aggregate.empty())
+    {
+        for(unsigned int f = 0; f < sizeof(aggNames) / sizeof(aggNames[0]); f++)
+        {
+            if(aggregate == aggNames[f])
+                spec.func_ = f;
+        }
+        spec.column_ = aggcolumn - 1;
+        if(aggroup > 0)
+            spec.group_ = aggroup - 1;
+        if(!isIntegerOutput(sin, select1, sout, select2, spec.column_)
+                || (spec.grouped() && !isIntegerOutput(sin, select1, sout, select2, spec.group_)))
+        {
+            cout << "Aggregates need integer output columns, disabled" << endl;
+            aggregate.clear();
+        }
+    }
+    unsigned int output = joiner->get_output();
+    if(output_mode::WRITE_NT == output && 16 != outputTupleSize(sin, select1, sout, select2))
+    {
+        cout << "Non-temporal writes need 16-byte output tuples, writing normally" << endl;
+        output = output_mode::WRITE;
+        joiner->set_output(output);
+    }
+    if(!aggregate.empty() && output_mode::DISCARD == output)
+    {
+        cout << "Aggregates need assembled or aggregated output, disabled" << endl;
+        aggregate.clear();
+    }
+    if(!aggregate.empty())
+    {
+        joiner->set_aggregate(spec);
+        if(!spec.grouped() && aggchunk > 0)
+        {
+            chunks = new ChunkAggregates(aggchunk);
+        }
+        resultcache = "no";
+    }
+    if("yes" == resultcache)
+    {
+        if(output_mode::WRITE == output || output_mode::WRITE_NT == output)
+            results = new ResultCache(cache, resultcachesize > 0
+                    ? (unsigned long long)resultcachesize << 20 : budget.get_budget(0) / 4);
+        else
+            cout << "Result cache needs written output, disabled" << endl;
+    }
     srand((int)time(0));
     ht_node* node = NULL;
+    RangePredictor predictor;
+    SpeculativeBuilder* speculator = NULL;
+    BaseAlgo* spec_joiner = NULL;
+    if("yes" == speculate)
+    {
+        spec_joiner = JoinerFactory::createJoiner(cfg);
+        spec_joiner->set_build_table(tin);
+        spec_joiner->set_cache(cache);
+        speculator = new SpeculativeBuilder(spec_joiner, cache, tin, infilename, bucksize,
+                tin->schema(), select1, joinattr1, tout->schema(), select2, joinattr2,
+                selectivity);
+        speculator->start();
+    }
+    cond_s = random(total/100*(100-selectivity));
     for(unsigned int i = 0; i < num; i++)
     {
         cout<<"Running hash join algorithm! Join No.: "<<i<<flush<<endl;
-        cond_s = random(total/100*(100-selectivity));
+        if(0 == step)
+        {
+            cond_s = random(total/100*(100-selectivity));
+        }
+        else if(i > 0)
+        {
+            cond_s = (cond_s + step) % (total/100*(100-selectivity));
+        }
         cond_e = cond_s + total/100*selectivity;
-        cout<<"predication filter ["<<cond_s<<", "<<cond_e<<"]"<<flush<<endl;
+        IntervalSet pred = slicePredicate(cond_s, cond_e, ranges);
+        for(unsigned int k = 0; k < inlist; k++)
+        {
+            unsigned long long key = random(total);
+            pred.add(key, key);
+        }
+        if(pred.empty())
+        {
+            pred.add(cond_s, cond_e);
+        }
+        cout<<"predication filter ["<<pred.lo()<<", "<<pred.hi()<<"] in "<<pred.size()<<" intervals"<<flush<<endl;
         initchkpt();
 
-        if(NULL == (node = cache->get_reusable_ht(cond_s,cond_e)))
+        joiner->init(tin->schema(),select1,joinattr1,
+                     tout->schema(),select2,joinattr2,
+                     selectivity,pred.lo(),pred.hi());
+        joiner->set_predicate(pred);
+        BuildFilter filter;
+        unsigned int shrink = filtershrink < 50 ? filtershrink : 50;
+        for(unsigned int f = 0; f < fcolumns.size(); f++)
+        {
+            unsigned long long cut = (unsigned long long)(fhi[f] - flo[f]) * shrink / 100;
+            unsigned long long lo = flo[f] + random((cut + 1));
+            unsigned long long hi = fhi[f] - random((cut + 1));
+            filter.add(fcolumns[f], IntervalSet(lo, hi));
+            cout<<"build filter on column "<<fcolumns[f]+1<<": ["<<lo<<", "<<hi<<"]"<<flush<<endl;
+        }
+        joiner->set_filter(filter);
+
+        cache_key bkey(infilename, joinattr1, select1);
+        bkey.filter_ = filter;
+        result_key rkey(bkey, cache_key(outfilename, joinattr2, select2));
+        PageCursor* t = NULL;
+        agg_value agg_total;
+        GroupTable groups;
+        agg_node* tally = NULL;
+        if(NULL != chunks)
+        {
+            // build and probe only the keys no kept chunk covers
+            pred = chunks->combine(rkey, spec.column_, pred, agg_total);
+            if(!pred.empty())
+            {
+                cout<<"probing ["<<pred.lo()<<", "<<pred.hi()<<"] in "<<pred.size()<<" intervals"<<flush<<endl;
+                joiner->set_predicate(pred);
+            }
+        }
+        else if(NULL != results)
+        {
+            t = results->answer(rkey, pred);
+        }
+        if(NULL != t || pred.empty())
         {
-            node = cache->insert(cond_s,cond_e,bucksize,buffsize);
-            joiner->init(tin->schema(),select1,joinattr1,
-                         tout->schema(),select2,joinattr2,
-                         selectivity,cond_s,cond_e);
+            buildchkpt();
+            predictor.observe(cond_s,cond_e);
+            probechkpt();
+            cout<< "RUNTIME TOTAL, BUILD_PART: "<<timer1<<" PROBE_PART: "<<timer2-timer1<<" TOTAL: "<<timer2<<endl;
+            if(!aggregate.empty())
+            {
+                printAggregate(spec, agg_total, groups);
+            }
+            cout<<"Finshing hash join algorithm! Join No.: "<<i<<flush<<endl;
+            if(NULL != t)
+            {
+                t->close();
+                delete t;
+            }
+            cout<<endl;
+            tin->reset();
+            tout->reset();
+            resetchkpt();
+            continue;
+        }
+
+        cache_key key = joiner->get_cache_key(infilename);
+        if(NULL == (node = cache->get_reusable_ht(key,pred)))
+        {
+            node = cache->insert(joiner->get_build_key(infilename),pred,bucksize,
+                    joiner->get_build_tuple_size(), joiner->get_build_key_size());
             //node->hashtable_->print();
         }
         else
         {
             cout << "Got a reusable hashtable["<<node->start_value_<<","<<node->end_value_<<"]!" <<flush <<endl;
             //node->hashtable_->print();
-            joiner->init(tin->schema(),select1,joinattr1,
-                         tout->schema(),select2,joinattr2,
-                         selectivity,cond_s,cond_e);
         }
 
         //cache.print_cache();
         joiner->build(tin,node);
         buildchkpt();
+        cache->record_build(node,timer1);
+        cache->publish(node);
+        predictor.observe(cond_s,cond_e);
+        unsigned long long next_s, next_e;
+        if(NULL != speculator && predictor.predict(next_s,next_e))
+        {
+            // the unshrunk filter serves whatever filter the next query draws
+            BuildFilter widest;
+            for(unsigned int f = 0; f < fcolumns.size(); f++)
+            {
+                widest.add(fcolumns[f], IntervalSet(flo[f], fhi[f]));
+            }
+            IntervalSet next = slicePredicate(next_s, next_e, ranges);
+            if(next.empty())
+            {
+                next.add(next_s, next_e);
+            }
+            speculator->request(next, widest);
+        }
         //node->hashtable_->print();
-        PageCursor* t = joiner->probe(tout,node);
+        result_node* record = NULL;
+        if(NULL != results)
+        {
+            record = results->record(rkey, pred, joiner->get_output_schema(), buffsize);
+            joiner->set_recorder(record);
+        }
+        if(NULL != chunks)
+        {
+            tally = chunks->record(rkey, spec.column_, pred);
+            joiner->set_aggregator(tally);
+        }
+        t = joiner->probe(tout,node);
+        if(NULL != tally)
+        {
+            joiner->set_aggregator(NULL);
+            chunks->publish(tally, agg_total);
+        }
+        if(!aggregate.empty())
+        {
+            joiner->get_aggregate(agg_total, groups);
+        }
         probechkpt();
         cout<< "RUNTIME TOTAL, BUILD_PART: "<<timer1<<" PROBE_PART: "<<timer2-timer1<<" TOTAL: "<<timer2<<endl;
+        if(!aggregate.empty())
+        {
+            printAggregate(spec, agg_total, groups);
+        }
         cout<<"Finshing hash join algorithm! Join No.: "<<i<<flush<<endl;
-        t->close();
-        delete t;
+        if(NULL != t)
+        {
+            t->close();
+            delete t;
+        }
+        cache->release(node);
+        cache->compact();
+        if(NULL != record)
+        {
+            joiner->set_recorder(NULL);
+            results->publish(record);
+        }
+        if(0 == cachesize)
+        {
+            unsigned long long bytes = cache->get_bytes() + cache->get_frozen_bytes();
+            unsigned long long max_bytes = budget.get_budget(bytes);
+            if(budget.under_pressure() && bytes / 4 * 3 < max_bytes)
+            {
+                // give back a quarter of the cache right away
+                max_bytes = bytes / 4 * 3;
+                cout << "Memory pressure, shrinking the cache to "<<max_bytes<<" bytes"<<flush<<endl;
+            }
+            cache->set_max_bytes(max_bytes);
+            if(NULL != results)
+            {
+                results->fit();
+            }
+        }
+        cache->garbage_collection();
+        if(statsout.is_open() && statsevery > 0 && (i+1) % statsevery == 0)
+        {
+            if("csv" == statsformat)
+                cache->dump_csv(statsout);
+            else
+                cache->dump_json(statsout);
+        }
         cout<<endl;
         tin->reset();
         tout->reset();
@@ -204,7 +584,28 @@ int main(int argc, char** argv)
 
 //    PageCursor* t = joiner->probe(tout);
 
+    if(NULL != speculator)
+    {
+        speculator->stop();
+        delete speculator;
+        spec_joiner->destroy();
+        delete spec_joiner;
+    }
+    if(statsout.is_open())
+    {
+        if("csv" == statsformat)
+            cache->dump_csv(statsout);
+        else
+            cache->dump_json(statsout);
+        statsout.close();
+    }
+    if(!snapshot.empty())
+    {
+        cache->save((datapath+snapshot).c_str());
+    }
     joiner->destroy();
+    delete results;
+    delete chunks;
     cache->destroy();
 
     cout << "OK" << endl;
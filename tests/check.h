@@ -0,0 +1,43 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <iostream>
+
+/**
+ * Minimal test harness, see the test target of the Makefile. CHECK()
+ * reports a failed condition and counts it; a test returns
+ * check_result() from main.
+ */
+static unsigned int check_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+            ++check_failures; \
+        } \
+    } while (0)
+
+inline int check_result(const char* name)
+{
+    std::cerr << name << (check_failures ? ": FAILED" : ": ok") << std::endl;
+    return check_failures ? 1 : 0;
+}
+
+#endif // CHECK_H
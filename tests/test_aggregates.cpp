@@ -0,0 +1,169 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "check.h"
+#include "../common/aggregates.h"
+#include <cstdlib>
+
+static const unsigned long long WIDTH = 10;
+static const unsigned long long UNIVERSE = 200;
+
+/** Value of the output tuples joined on \a key, some keys join twice. */
+static long long value(unsigned long long key)
+{
+    return (long long)(key * 37 % 101) - 50;
+}
+
+static unsigned int matches(unsigned long long key)
+{
+    return key % 7 == 3 ? 2 : 1;
+}
+
+/** Aggregates of every output tuple joined on \a keys. */
+static agg_value expected(const IntervalSet& keys)
+{
+    agg_value ret;
+    for (unsigned long long k = 0; k < UNIVERSE; ++k)
+    {
+        for (unsigned int m = keys.contains(k) ? matches(k) : 0; m > 0; --m)
+            ret.add(value(k));
+    }
+    return ret;
+}
+
+static bool same(const agg_value& a, const agg_value& b)
+{
+    return a.count_ == b.count_ && a.sum_ == b.sum_ && a.min_ == b.min_ && a.max_ == b.max_;
+}
+
+/**
+ * Runs a query on \a keys the way main does: combines the kept chunks,
+ * probes what is left and publishes it. Returns the keys probed.
+ */
+static IntervalSet query(ChunkAggregates& chunks, const result_key& key, unsigned int column,
+        const IntervalSet& keys, agg_value& total)
+{
+    IntervalSet rest = chunks.combine(key, column, keys, total);
+    agg_node* node = chunks.record(key, column, rest);
+    for (unsigned int i = 0; i < rest.size(); ++i)
+    {
+        for (unsigned long long k = rest.get_lo(i); k <= rest.get_hi(i); ++k)
+        {
+            for (unsigned int m = matches(k); m > 0; --m)
+                node->add(k, value(k));
+        }
+    }
+    chunks.publish(node, total);
+    return rest;
+}
+
+/** Checks a GroupTable against a plain map, through growth, merge and clear. */
+static void group_table()
+{
+    GroupTable a;
+    GroupTable b;
+    map<long long, agg_value> want;
+    CHECK(a.size() == 0 && a.total().count_ == 0);
+    // enough groups to grow past the first 1024 slots, negative ones too
+    for (long long i = 0; i < 20000; ++i)
+    {
+        long long group = (i * 7919) % 3001 - 1500;
+        long long v = i % 211 - 100;
+        (i % 2 ? a : b).add(group, v);
+        want[group].add(v);
+    }
+    a.merge(b);
+    CHECK(a.size() == want.size());
+    agg_value all;
+    for (map<long long, agg_value>::const_iterator it = want.begin(); it != want.end(); ++it)
+        all.merge(it->second);
+    CHECK(same(a.total(), all));
+
+    // a group both tables hold is merged into one slot
+    GroupTable one;
+    GroupTable two;
+    one.add(-1500, 5);
+    two.add(-1500, 7);
+    one.merge(two);
+    CHECK(one.size() == 1 && one.total().count_ == 2 && one.total().sum_ == 12);
+    CHECK(one.total().get(agg_spec::MAX) == 7);
+
+    a.clear();
+    CHECK(a.size() == 0 && a.total().count_ == 0);
+    a.add(3, 4);
+    CHECK(a.size() == 1 && a.total().get(agg_spec::SUM) == 4);
+    CHECK(a.total().get(agg_spec::MIN) == 4 && a.total().get(agg_spec::COUNT) == 1);
+}
+
+int main()
+{
+    group_table();
+
+    result_key key(cache_key("build.tbl", 1, std::vector<unsigned int>(1, 2)),
+            cache_key("probe.tbl", 0, std::vector<unsigned int>(1, 1)));
+    result_key other(cache_key("other.tbl", 1, std::vector<unsigned int>(1, 2)),
+            cache_key("probe.tbl", 0, std::vector<unsigned int>(1, 1)));
+
+    // nothing kept yet, everything is probed
+    ChunkAggregates chunks(WIDTH);
+    agg_value total;
+    CHECK(query(chunks, key, 0, IntervalSet(5, 47), total) == IntervalSet(5, 47));
+    CHECK(same(total, expected(IntervalSet(5, 47))));
+
+    // only chunks 1 to 3 lay whole in [5, 47]
+    agg_value wide;
+    IntervalSet rest = chunks.combine(key, 0, IntervalSet(0, 99), wide);
+    IntervalSet edges(0, 9);
+    edges.add(40, 99);
+    CHECK(rest == edges);
+    CHECK(same(wide, expected(IntervalSet(10, 39))));
+
+    // a partly covered chunk is not combined
+    agg_value inner;
+    rest = chunks.combine(key, 0, IntervalSet(12, 35), inner);
+    IntervalSet around(12, 19);
+    around.add(30, 35);
+    CHECK(rest == around);
+    CHECK(same(inner, expected(IntervalSet(20, 29))));
+
+    // other queries and columns keep their own chunks
+    agg_value none;
+    CHECK(chunks.combine(other, 0, IntervalSet(0, 99), none) == IntervalSet(0, 99));
+    CHECK(chunks.combine(key, 1, IntervalSet(0, 99), none) == IntervalSet(0, 99));
+    CHECK(none.count_ == 0);
+
+    // random queries answer the same as a full probe, and a query whose
+    // chunks are all kept probes nothing but its edges
+    srand(5);
+    for (unsigned int i = 0; i < 500; ++i)
+    {
+        IntervalSet keys;
+        for (int n = 1 + rand() % 3; n > 0; --n)
+        {
+            unsigned long long lo = rand() % UNIVERSE;
+            keys.add(lo, lo + rand() % (UNIVERSE - lo));
+        }
+        agg_value got;
+        query(chunks, key, 0, keys, got);
+        CHECK(same(got, expected(keys)));
+        agg_value again;
+        IntervalSet probed = query(chunks, key, 0, keys, again);
+        CHECK(same(again, expected(keys)));
+        for (unsigned int j = 0; j < probed.size(); ++j)
+            CHECK(probed.get_hi(j) - probed.get_lo(j) < 2 * WIDTH);
+    }
+    return check_result("aggregates");
+}
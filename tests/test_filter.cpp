@@ -0,0 +1,117 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "check.h"
+#include "../common/filter.h"
+#include "../common/schema.h"
+#include <cstdlib>
+
+static const unsigned int COLUMNS = 3;
+static const unsigned int VALUES = 8;
+
+/** Random filter with a term on some of the columns, values below VALUES. */
+static BuildFilter random_filter()
+{
+    BuildFilter f;
+    for (unsigned int c = 0; c < COLUMNS; ++c)
+    {
+        if (rand() % 2)
+            continue;
+        IntervalSet keys;
+        for (int n = 1 + rand() % 2; n > 0; --n)
+        {
+            unsigned long long lo = rand() % VALUES;
+            keys.add(lo, lo + rand() % (VALUES - lo));
+        }
+        f.add(c, keys);
+    }
+    return f;
+}
+
+/** True if the tuple \a row of \a s passes \a f, terms read from their own column. */
+static bool passes(const BuildFilter& f, Schema& s, char* row)
+{
+    return f.passes(&s, row, f.columns());
+}
+
+int main()
+{
+    Schema s;
+    s.add(CT_LONG);
+    s.add(CT_INTEGER);
+    s.add(CT_LONG);
+    char row[64];
+
+    // terms stay sorted by column, one per column
+    BuildFilter f;
+    f.add(2, IntervalSet(0, 10));
+    f.add(0, IntervalSet(5, 9));
+    f.add(2, IntervalSet(8, 20));
+    CHECK(f.size() == 2 && f.get_column(0) == 0 && f.get_column(1) == 2);
+    CHECK(f.get_keys(1) == IntervalSet(8, 10));
+
+    // no filter holds every tuple, and only tighter terms are implied
+    BuildFilter none;
+    BuildFilter loose;
+    loose.add(0, IntervalSet(0, 100));
+    BuildFilter tight;
+    tight.add(0, IntervalSet(10, 20));
+    tight.add(1, IntervalSet(3, 3));
+    CHECK(none.subsumes(loose) && none.subsumes(none));
+    CHECK(loose.subsumes(tight) && !tight.subsumes(loose));
+    CHECK(!loose.subsumes(none));
+    // a table built under loose holds keys tight drops, so all of tight is checked
+    CHECK(tight.residual(loose) == tight);
+    CHECK(tight.residual(none) == tight);
+    CHECK(loose.residual(tight).empty());
+    BuildFilter same;
+    same.add(0, IntervalSet(10, 20));
+    CHECK(tight.residual(same).size() == 1 && tight.residual(same).get_column(0) == 1);
+
+    // int columns are read at their width
+    *(long long*)s.calc_offset(row, 0) = 15;
+    *(int*)s.calc_offset(row, 1) = 3;
+    *(long long*)s.calc_offset(row, 2) = 0;
+    CHECK(passes(tight, s, row) && passes(loose, s, row) && passes(none, s, row));
+    *(int*)s.calc_offset(row, 1) = 4;
+    CHECK(!passes(tight, s, row));
+
+    // against every tuple of a small domain: subsumes() never claims a
+    // tuple the weaker filter drops, and the residual decides the rest
+    srand(11);
+    for (unsigned int i = 0; i < 300; ++i)
+    {
+        BuildFilter a = random_filter();
+        BuildFilter b = random_filter();
+        bool sub = a.subsumes(b);
+        BuildFilter rest = b.residual(a);
+        unsigned int wrong = 0;
+        for (unsigned int x = 0; x < VALUES + 1; ++x)
+        for (unsigned int y = 0; y < VALUES + 1; ++y)
+        for (unsigned int z = 0; z < VALUES + 1; ++z)
+        {
+            *(long long*)s.calc_offset(row, 0) = x;
+            *(int*)s.calc_offset(row, 1) = y;
+            *(long long*)s.calc_offset(row, 2) = z;
+            bool pa = passes(a, s, row);
+            bool pb = passes(b, s, row);
+            wrong += sub && pb && !pa;
+            wrong += pa && pb != passes(rest, s, row);
+        }
+        CHECK(wrong == 0);
+    }
+    return check_result("filter");
+}
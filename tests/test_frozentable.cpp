@@ -0,0 +1,138 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "check.h"
+#include "../algo/frozentable.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/** All entries of \a table as byte strings, sorted. */
+static std::vector<std::string> entries(HashTable* table)
+{
+    std::vector<std::string> all;
+    HashTable::Iterator it = table->create_iterator();
+    for (unsigned int i = 0; i < table->get_bucket_num(); ++i)
+    {
+        void* tup;
+        table->place_iterator(it, i);
+        while ((tup = it.read_next()))
+            all.push_back(std::string((const char*)tup, table->get_tuple_size()));
+    }
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+/** Adds \a key with the columns \a words and raw trailing bytes to \a table. */
+static void add(HashTable* table, unsigned long long key, const std::vector<unsigned long long>& words)
+{
+    std::vector<char> entry(table->get_tuple_size(), 0);
+    table->put_key(&entry[0], key);
+    unsigned int off = table->get_key_width();
+    for (unsigned int w = 0; w < words.size(); ++w, off += sizeof(unsigned long long))
+        memcpy(&entry[off], &words[w], sizeof(unsigned long long));
+    for (; off < entry.size(); ++off)
+        entry[off] = (char)(key * 7 + off);
+    table->insert(table->hash(key), &entry[0]);
+}
+
+/**
+ * Freezes \a table, optionally deep, thaws it into a new table and checks
+ * that the entries, the key layout and the filter came back.
+ */
+static void round_trip(HashTable* table, bool deep)
+{
+    FrozenTable frozen;
+    frozen.freeze(table);
+    CHECK(frozen.get_tuple_num() == table->get_tuple_num());
+    if (deep)
+        frozen.deep_freeze();
+
+    HashTable thawed;
+    BloomFilter bloom;
+    CHECK(frozen.thaw(&thawed, &bloom));
+    CHECK(thawed.get_tuple_num() == table->get_tuple_num());
+    CHECK(thawed.get_key_width() == table->get_key_width());
+    CHECK(thawed.get_hash_width() == table->get_hash_width());
+    CHECK(entries(&thawed) == entries(table));
+
+    // every key is found through the filter and its bucket
+    unsigned long long missing = 0;
+    HashTable::Iterator it = thawed.create_iterator();
+    std::vector<std::string> all = entries(table);
+    for (unsigned int i = 0; i < all.size(); ++i)
+    {
+        unsigned long long key = thawed.get_key(all[i].data());
+        HashTable::hash_t hash = thawed.hash(key);
+        bool found = false;
+        thawed.probe_iterator(it, hash);
+        void* tup;
+        while (!found && (tup = it.read_next(HashTable::make_tag(hash))))
+            found = thawed.get_key(tup) == key;
+        missing += !found || !bloom.contains(hash);
+    }
+    CHECK(missing == 0);
+
+    bloom.destroy();
+    thawed.destroy();
+    frozen.destroy();
+}
+
+int main()
+{
+    // key deltas from 0 to 2^40 take one to six varint bytes, columns
+    // span from constant to full 64-bit frames
+    HashTable wide;
+    wide.init(16, 256, 3 * sizeof(unsigned long long));
+    unsigned long long key = 5;
+    for (unsigned int i = 0; i < 1000; ++i)
+    {
+        key += i % 10 == 0 ? 0 : (1ULL << (i % 41));
+        std::vector<unsigned long long> words;
+        words.push_back(42);
+        words.push_back(i % 3 ? ~0ULL - i : i);
+        add(&wide, key, words);
+    }
+    round_trip(&wide, false);
+    round_trip(&wide, true);
+
+    // 32-bit keys relative to a base, one column and 4 raw trailing bytes
+    HashTable narrow;
+    narrow.init(8, 128, sizeof(int) + sizeof(unsigned long long) + 4);
+    narrow.set_key_base(1ULL << 33);
+    narrow.set_hash_width(sizeof(int));
+    for (unsigned int i = 0; i < 300; ++i)
+        add(&narrow, (1ULL << 33) + i * 977, std::vector<unsigned long long>(1, i * i));
+    round_trip(&narrow, false);
+    round_trip(&narrow, true);
+
+    // exactly one block of keys only
+    HashTable keys;
+    keys.init(4, 64, sizeof(unsigned long long));
+    for (unsigned int i = 0; i < 128; ++i)
+        add(&keys, 1000 - i, std::vector<unsigned long long>());
+    round_trip(&keys, true);
+
+    HashTable empty;
+    empty.init(1, 64, 2 * sizeof(unsigned long long));
+    round_trip(&empty, true);
+
+    empty.destroy();
+    keys.destroy();
+    narrow.destroy();
+    wide.destroy();
+    return check_result("frozentable");
+}
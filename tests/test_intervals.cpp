@@ -0,0 +1,104 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "check.h"
+#include "../common/intervals.h"
+#include <cstdlib>
+
+static const unsigned int UNIVERSE = 64;
+
+/** Random set of up to 4 intervals in [0, UNIVERSE), also as a bit mask. */
+static IntervalSet random_set(unsigned long long& mask)
+{
+    IntervalSet set;
+    mask = 0;
+    for (int n = rand() % 5; n > 0; --n)
+    {
+        unsigned long long lo = rand() % UNIVERSE;
+        unsigned long long hi = lo + rand() % (UNIVERSE - lo);
+        set.add(lo, hi);
+        for (unsigned long long k = lo; k <= hi; ++k)
+            mask |= 1ULL << k;
+    }
+    return set;
+}
+
+/** True if \a set holds exactly the keys of \a mask. */
+static bool same(const IntervalSet& set, unsigned long long mask)
+{
+    unsigned long long width = 0;
+    for (unsigned int k = 0; k < UNIVERSE + 8; ++k)
+    {
+        bool in = k < UNIVERSE && (mask >> k) & 1;
+        if (set.contains((unsigned long long)k) != in)
+            return false;
+        width += in;
+    }
+    return set.width() == width;
+}
+
+int main()
+{
+    IntervalSet empty;
+    CHECK(empty.empty() && empty.size() == 0 && empty.width() == 0);
+    CHECK(empty.lo() == 0 && empty.hi() == 0);
+    CHECK(!empty.contains(0ULL));
+
+    // touching intervals merge, separate ones stay apart
+    IntervalSet s(10, 20);
+    s.add(21, 30);
+    CHECK(s.size() == 1 && s.get_lo(0) == 10 && s.get_hi(0) == 30);
+    s.add(40, 50);
+    s.add(5, 8);
+    CHECK(s.size() == 3 && s.lo() == 5 && s.hi() == 50);
+    CHECK(s.width() == 4 + 21 + 11);
+    CHECK(s.contains(5ULL) && s.contains(8ULL) && !s.contains(9ULL) && s.contains(10ULL));
+    CHECK(s.contains(30ULL) && !s.contains(31ULL) && !s.contains(39ULL) && s.contains(50ULL));
+    CHECK(!s.contains(4ULL) && !s.contains(51ULL));
+    s.add(9, 39);
+    CHECK(s.size() == 1 && s == IntervalSet(5, 50));
+
+    // the largest key is reserved for padding
+    IntervalSet top(~0ULL - 10, ~0ULL);
+    CHECK(top.hi() == ~0ULL - 1 && top.width() == 10);
+    CHECK(top.contains(~0ULL - 1) && !top.contains(~0ULL) && !top.contains(~0ULL - 11));
+
+    CHECK(IntervalSet(0, 100).contains(IntervalSet(10, 20)));
+    CHECK(!IntervalSet(10, 20).contains(IntervalSet(0, 100)));
+    CHECK(IntervalSet(0, 10).overlaps(IntervalSet(10, 20)));
+    CHECK(!IntervalSet(0, 9).overlaps(IntervalSet(10, 20)));
+    CHECK(IntervalSet(0, 100).minus(IntervalSet(0, 100)).empty());
+
+    // set algebra against bit masks
+    srand(7);
+    for (unsigned int i = 0; i < 5000; ++i)
+    {
+        unsigned long long ma, mb;
+        IntervalSet a = random_set(ma);
+        IntervalSet b = random_set(mb);
+        CHECK(same(a, ma));
+        CHECK(same(a.unite(b), ma | mb));
+        CHECK(same(a.intersect(b), ma & mb));
+        CHECK(same(a.minus(b), ma & ~mb));
+        CHECK(a.overlaps(b) == ((ma & mb) != 0));
+        CHECK(a.contains(b) == ((mb & ~ma) == 0));
+        // equal key sets have equal bounds
+        CHECK(a.unite(b) == b.unite(a));
+        CHECK(a.intersect(b) == b.intersect(a));
+        CHECK(a.minus(b).unite(a.intersect(b)) == a);
+    }
+    return check_result("intervals");
+}
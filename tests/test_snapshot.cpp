@@ -0,0 +1,135 @@
+/*
+    Copyright 2018. simba wei
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "check.h"
+#include "../common/cache.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+static const unsigned long long LO = 1000;
+static const unsigned long long HI = 5999;
+
+/** Payload stored after the key of \a key. */
+static unsigned long long payload(unsigned long long key)
+{
+    return key * 3 + 1;
+}
+
+/** Builds [LO, HI] of \a key into a new node of \a cache and publishes it. */
+static void build(ReuseCache& cache, const cache_key& key)
+{
+    IntervalSet want(LO, HI);
+    ht_node* node = cache.insert(key, want, 4096, 2 * sizeof(unsigned long long), sizeof(unsigned long long));
+    CHECK(!node->transient_);
+    HashTable* ht = node->hashtable_;
+    char entry[2 * sizeof(unsigned long long)];
+    for (unsigned long long k = LO; k <= HI; ++k)
+    {
+        unsigned long long v = payload(k);
+        ht->put_key(entry, k);
+        memcpy(entry + ht->get_key_width(), &v, sizeof(v));
+        HashTable::hash_t hash = ht->hash(k);
+        ht->insert(hash, entry);
+        node->bloom_->add(hash);
+    }
+    node->set_ranges(want);
+    cache.publish(node);
+    cache.release(node);
+}
+
+/** True if \a node holds \a k with its payload. */
+static bool holds(ht_node* node, unsigned long long k)
+{
+    HashTable* ht = node->hashtable_;
+    HashTable::hash_t hash = ht->hash(k);
+    if (!node->bloom_->contains(hash))
+        return false;
+    HashTable::Iterator it = ht->create_iterator();
+    ht->probe_iterator(it, hash);
+    void* tup;
+    while ((tup = it.read_next(HashTable::make_tag(hash))))
+    {
+        unsigned long long v;
+        memcpy(&v, (char*)tup + ht->get_key_width(), sizeof(v));
+        if (ht->get_key(tup) == k && v == payload(k))
+            return true;
+    }
+    return false;
+}
+
+/** Copies the first \a len bytes of \a from to \a to. */
+static void truncate_copy(const std::string& from, const std::string& to, std::streamsize len)
+{
+    std::ifstream in(from.c_str(), std::ios::binary);
+    std::ofstream out(to.c_str(), std::ios::binary);
+    std::vector<char> buf(len);
+    in.read(&buf[0], len);
+    out.write(&buf[0], in.gcount());
+}
+
+int main()
+{
+    std::ostringstream name;
+    name << "/tmp/reuse-test-" << getpid() << ".snap";
+    std::string path = name.str();
+    std::string cut = path + ".cut";
+
+    cache_key key("build.tbl", 1, std::vector<unsigned int>(1, 2));
+    ReuseCache cache(1ULL << 30);
+    build(cache, key);
+    CHECK(cache.save(path.c_str()) == 1);
+
+    // the loaded node answers lookups without a rebuild
+    ReuseCache loaded(1ULL << 30);
+    CHECK(loaded.load(path.c_str()) == 1);
+    ht_node* node = loaded.get_reusable_ht(key, IntervalSet(LO + 10, HI - 10));
+    CHECK(node != NULL);
+    if (node)
+    {
+        CHECK(node->published_ && node->map_addr_ != NULL);
+        CHECK(node->ranges_ == IntervalSet(LO, HI));
+        CHECK(node->hashtable_->get_tuple_num() == HI - LO + 1);
+        unsigned long long missing = 0;
+        for (unsigned long long k = LO; k <= HI; ++k)
+        {
+            missing += !holds(node, k);
+        }
+        CHECK(missing == 0);
+        CHECK(!holds(node, HI + 1));
+        loaded.release(node);
+    }
+
+    // another table or join attribute does not match the entry
+    CHECK(loaded.get_reusable_ht(cache_key("other.tbl", 1, std::vector<unsigned int>(1, 2)),
+                IntervalSet(LO, HI)) == NULL);
+
+    // a truncated file loads nothing instead of mapping past its end
+    std::ifstream whole(path.c_str(), std::ios::binary | std::ios::ate);
+    std::streamsize size = whole.tellg();
+    truncate_copy(path, cut, size / 2);
+    ReuseCache partial(1ULL << 30);
+    CHECK(partial.load(cut.c_str()) == 0);
+    CHECK(partial.load("/nonexistent/reuse.snap") == 0);
+
+    partial.destroy();
+    loaded.destroy();
+    cache.destroy();
+    unlink(path.c_str());
+    unlink(cut.c_str());
+    return check_result("snapshot");
+}